@@ -0,0 +1,84 @@
+#!/bin/bash
+set -e
+
+# Builds for the end-to-end overhead benchmark (run_bench.sh), natively
+# against the software TEE like ../build_soft.sh, so no Raspberry Pi is
+# needed. Every app is built from the same -O0 IR twice over:
+#   <app>_base            uninstrumented, linked with oat_null.c
+#   <app>_<config>        instrumented with each OAT_BENCH_CONFIGS entry
+# The syringe pump additionally gets a *_nodelay variant of each, whose
+# delayMicroseconds() does not sleep.
+
+# --- CONFIGURATION ---
+CC="${CC:-cc}"
+SOFT_TEE="../soft_tee"
+TA_DIR="../../ta/oat/ta"
+OAT_PASS="${OAT_PASS:-../OATPass.so}"
+# Instrumented configurations, space-separated "name=pass options", e.g.
+# OAT_BENCH_CONFIGS="oat= paths=path-log;loop-compress"
+OAT_BENCH_CONFIGS="${OAT_BENCH_CONFIGS:-oat=}"
+OUT="bench_build"
+
+mkdir -p $OUT
+
+# --- BUILD STEPS ---
+
+# 1. Runtimes: liboat + software TEE, and the do-nothing baseline
+echo "[1/4] Building runtimes..."
+for src in $SOFT_TEE/sha256.c $SOFT_TEE/soft_tee_internal.c $SOFT_TEE/soft_teec.c; do
+    $CC -O2 -c $src -o $OUT/$(basename ${src%.c}).o -I$SOFT_TEE
+done
+for src in $TA_DIR/oat_ta.c $TA_DIR/blake2s.c; do
+    $CC -O2 -c $src -o $OUT/$(basename ${src%.c}).o -I$SOFT_TEE -I$TA_DIR/include
+done
+$CC -O2 -c ../liboat.c -o $OUT/liboat.o -I$SOFT_TEE
+ar rcs $OUT/liboat_soft.a $OUT/liboat.o $OUT/soft_teec.o $OUT/soft_tee_internal.o \
+    $OUT/sha256.o $OUT/oat_ta.o $OUT/blake2s.o
+$CC -O2 -c oat_null.c -o $OUT/oat_null.o
+
+# 2. IR: drone test, syringe pump with and without hardware delays
+echo "[2/4] Generating IR..."
+CLANG_FLAGS="-S -emit-llvm -O0 -Xclang -disable-O0-optnone"
+clang $CLANG_FLAGS ../drone_test.c -o $OUT/drone.ll
+for src in syringePump LiquidCrystal led util; do
+    clang $CLANG_FLAGS ../syringe/$src.c -o $OUT/$src.ll
+done
+clang $CLANG_FLAGS -DOAT_BENCH_NO_DELAY ../syringe/util.c -o $OUT/util_nodelay.ll
+llvm-link $OUT/syringePump.ll $OUT/util.ll $OUT/LiquidCrystal.ll $OUT/led.ll \
+    -S -o $OUT/syringe.ll
+llvm-link $OUT/syringePump.ll $OUT/util_nodelay.ll $OUT/LiquidCrystal.ll $OUT/led.ll \
+    -S -o $OUT/syringe_nodelay.ll
+
+APPS="drone syringe syringe_nodelay"
+
+# <app IR> <binary name> <runtime>
+link_app() {
+    llc -filetype=obj -relocation-model=pic $1 -o $OUT/$2.o
+    $CC $OUT/$2.o $3 -o $OUT/$2 -lpthread -lm
+}
+
+# 3. Uninstrumented
+echo "[3/4] Linking baselines..."
+for app in $APPS; do
+    name=${app/nodelay/base_nodelay}
+    [ "$name" = "$app" ] && name=${app}_base
+    link_app $OUT/$app.ll $name $OUT/oat_null.o
+done
+
+# 4. Instrumented, once per configuration
+echo "[4/4] Instrumenting..."
+for cfg in $OAT_BENCH_CONFIGS; do
+    cname=${cfg%%=*}
+    opts=${cfg#*=}
+    for app in $APPS; do
+        name=${app/nodelay/${cname}_nodelay}
+        [ "$name" = "$app" ] && name=${app}_$cname
+        opt -load-pass-plugin=$OAT_PASS -passes="oat-pass${opts:+<$opts>}" \
+            $OUT/$app.ll -S -o $OUT/${name}.ll
+        link_app $OUT/${name}.ll $name $OUT/liboat_soft.a
+    done
+done
+
+echo ""
+echo "DONE! Binaries in '$OUT/'. Run the benchmark with:"
+echo "  ./run_bench.sh [reps] [script] > overhead.csv"
@@ -0,0 +1,11 @@
+/* host/bench/oat_null.c
+ * Baseline runtime for the overhead benchmark: the application-facing
+ * calls of liboat.c, doing nothing. Uninstrumented builds link this
+ * instead of liboat, so they pay neither the hooks nor the TEE session.
+ */
+#include <stdint.h>
+
+void __oat_init(void) { }
+void __oat_print_proof(void) { }
+void __oat_export_log(const char *filename) { (void)filename; }
+int __oat_export_stats(const char *filename) { (void)filename; return 0; }
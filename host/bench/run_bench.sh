@@ -0,0 +1,94 @@
+#!/bin/bash
+set -e
+
+# End-to-end overhead benchmark (paper Table III runtime columns) over the
+# builds of build_bench.sh. Prints one CSV row per app and configuration:
+#   app,config,delays,tee_latency_ns,ops,median_us,p99_us,overhead_pct,events_per_op
+# overhead_pct compares median operation time with the app's "base" build.
+#
+# usage: run_bench.sh [reps] [script]
+#   reps    runs of each binary (default 10)
+#   script  syringe operations, one loop() count per line (default syringe_ops.txt)
+# OAT_BENCH_NO_DELAY=1   run the syringe builds whose motor steps do not sleep
+# OAT_SOFT_LATENCY_NS=n  simulated world-switch cost, passed to the software TEE
+#
+# Syringe operations are timed by the pump itself (__oat_init() to
+# __oat_export_stats(), as its "time usecs" line); the drone test has one
+# operation per run and is timed as a whole process.
+
+REPS="${1:-10}"
+SCRIPT="$(realpath "${2:-syringe_ops.txt}")"
+OUT="$(realpath bench_build)"
+DELAYS=1
+[ "${OAT_BENCH_NO_DELAY:-0}" = "1" ] && DELAYS=0
+LATENCY="${OAT_SOFT_LATENCY_NS:-0}"
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Median and nearest-rank p99 of the numbers on stdin
+percentiles() {
+    sort -n | awk '{ v[NR] = $1 }
+        END {
+            if (NR == 0) { print "0 0"; exit }
+            m = NR % 2 ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2
+            r = int(NR * 0.99); if (r < NR * 0.99) r++
+            print m, v[r]
+        }'
+}
+
+# Hook events per operation from the statistics block __oat_print_proof()
+# prints: B.Cond, Ret, Icall, Loop, Path, CVI defs and uses
+events_per_op() {
+    awk -v ops="$1" '/^\[OAT\]  .*\): / {
+            split($0, f, "\\): *"); split(f[2], n, "[ /]")
+            sum += n[1] + (f[1] ~ /Def-Use/ ? n[2] : 0)
+        }
+        END { printf "%.1f", ops ? sum / ops : 0 }' "$WORK/out.txt"
+}
+
+# <app> <config> <binary>: one CSV row, median saved for the overhead
+bench() {
+    local app=$1 cfg=$2 bin=$OUT/$3
+    if [ ! -x "$bin" ]; then
+        echo "[OAT] Missing $bin, run build_bench.sh first" >&2
+        return
+    fi
+    : > "$WORK/out.txt"
+    : > "$WORK/us.txt"
+    for r in $(seq "$REPS"); do
+        if [ "$app" = drone ]; then
+            t0=$(date +%s%N)
+            (cd "$WORK" && "$bin" < /dev/null >> out.txt 2>&1)
+            echo $(( ($(date +%s%N) - t0) / 1000 )) >> "$WORK/us.txt"
+        else
+            (cd "$WORK" && "$bin" "$SCRIPT" < /dev/null > run.txt 2>&1)
+            cat "$WORK/run.txt" >> "$WORK/out.txt"
+            sed -n 's/.*time usecs: \([0-9]*\).*/\1/p' "$WORK/run.txt" >> "$WORK/us.txt"
+        fi
+    done
+
+    local ops median p99 overhead
+    ops=$(wc -l < "$WORK/us.txt")
+    read -r median p99 < <(percentiles < "$WORK/us.txt")
+    [ "$cfg" = base ] && BASE=$median
+    overhead=$(awk -v m="$median" -v b="$BASE" 'BEGIN { printf "%.2f", (b > 0 ? (m - b) * 100 / b : 0) }')
+    echo "$app,$cfg,$DELAYS,$LATENCY,$ops,$median,$p99,$overhead,$(events_per_op "$ops")"
+}
+
+echo "app,config,delays,tee_latency_ns,ops,median_us,p99_us,overhead_pct,events_per_op"
+for app in drone syringe; do
+    suffix=""
+    [ "$app" = syringe ] && [ "$DELAYS" = 0 ] && suffix="_nodelay"
+    BASE=0
+    bench $app base ${app}_base$suffix
+    for bin in "$OUT/${app}_"*"$suffix"; do
+        name=$(basename "$bin")
+        cfg=${name#${app}_}
+        cfg=${cfg%$suffix}
+        case "$cfg" in
+            base|*.*|*_nodelay) continue ;;
+        esac
+        bench $app "$cfg" "$name"
+    done
+done
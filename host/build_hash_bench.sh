@@ -0,0 +1,18 @@
+#!/bin/bash
+set -e
+
+# --- CONFIGURATION ---
+SYSROOT="/home/rajesh/latest_optee/optee_rpi3/out-br/host/aarch64-buildroot-linux-gnu/sysroot"
+OPTEE_CLIENT_PATH="$SYSROOT/usr"
+CROSS_CC="/home/rajesh/latest_optee/optee_rpi3/toolchains/aarch64/bin/aarch64-none-linux-gnu-gcc"
+
+# --- BUILD STEPS ---
+
+# Plain TEEC client, no instrumentation: the work happens inside the TA
+echo "[1] Building oat_hash_bench..."
+$CROSS_CC --sysroot=$SYSROOT oat_hash_bench.c -o oat_hash_bench \
+    -I$OPTEE_CLIENT_PATH/include \
+    -L$OPTEE_CLIENT_PATH/lib -lteec
+
+echo "DONE! Copy 'oat_hash_bench' to your Raspberry Pi and run:"
+echo "  oat_hash_bench [events] [runs]   # CSV: backend,events,run,elapsed_ms,ns_per_event"
@@ -29,7 +29,8 @@ clang -S -emit-llvm -O0 -Xclang -disable-O0-optnone \
 
 # 3. Run the "Ghost Editor" (OAT Pass)
 echo "[3] Running OAT Pass..."
-opt -load-pass-plugin=./OATPass.so -passes=oat-pass drone.ll -S -o drone_instrumented.ll
+#    Optional pass options, e.g. OAT_PASS_OPTS="loop-compress"
+opt -load-pass-plugin=./OATPass.so -passes="oat-pass${OAT_PASS_OPTS:+<$OAT_PASS_OPTS>}" drone.ll -S -o drone_instrumented.ll
 
 # 4. Convert IR to ARM Assembly
 echo "[4] Converting to ARM Assembly..."
@@ -39,6 +40,6 @@ llc -march=aarch64 -filetype=obj drone_instrumented.ll -o drone.o
 #    CRITICAL FIX: Added --sysroot here so the linker finds libc.so.6
 echo "[5] Linking Final Binary..."
 $CROSS_CC --sysroot=$SYSROOT drone.o liboat.o -o drone_app \
-    -L$OPTEE_CLIENT_PATH/lib -lteec
+    -L$OPTEE_CLIENT_PATH/lib -lteec -lpthread
 
 echo "DONE! Copy 'drone_app' to your Raspberry Pi."
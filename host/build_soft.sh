@@ -0,0 +1,67 @@
+#!/bin/bash
+set -e
+
+# Native build against the in-process software TEE (host/soft_tee):
+# no Raspberry Pi, OP-TEE or cross toolchain needed. liboat.c and oat_ta.c
+# are the same sources as the hardware build; only the link line differs.
+# Extra world-switch cost can be simulated at run time with
+# OAT_SOFT_LATENCY_NS=<ns per TEEC call>.
+
+# --- CONFIGURATION ---
+CC="${CC:-cc}"
+SOFT_TEE="soft_tee"
+TA_DIR="../ta/oat/ta"
+OAT_PASS="${OAT_PASS:-./OATPass.so}"
+# Optional pass options, e.g. OAT_PASS_OPTS="loop-compress"
+OAT_PASS_OPTS="${OAT_PASS_OPTS:-}"
+OUT="soft_build"
+
+mkdir -p $OUT
+
+# --- BUILD STEPS ---
+
+# 1. Software TEE: GP client/internal shims + the real TA, as one archive
+echo "[1/5] Building software TEE (liboat_soft.a)..."
+for src in $SOFT_TEE/sha256.c $SOFT_TEE/soft_tee_internal.c $SOFT_TEE/soft_teec.c; do
+    $CC -O2 -c $src -o $OUT/$(basename ${src%.c}).o -I$SOFT_TEE
+done
+for src in $TA_DIR/oat_ta.c $TA_DIR/blake2s.c; do
+    $CC -O2 -c $src -o $OUT/$(basename ${src%.c}).o -I$SOFT_TEE -I$TA_DIR/include
+done
+$CC -O2 -c liboat.c -o $OUT/liboat.o -I$SOFT_TEE
+ar rcs $OUT/liboat_soft.a $OUT/liboat.o $OUT/soft_teec.o $OUT/soft_tee_internal.o \
+    $OUT/sha256.o $OUT/oat_ta.o $OUT/blake2s.o
+
+# 2. Drone test apps (good + bad path)
+echo "[2/5] Instrumenting drone tests..."
+for app in drone_test drone_test_bad_path; do
+    clang -S -emit-llvm -O0 -Xclang -disable-O0-optnone $app.c -o $OUT/$app.ll
+    opt -load-pass-plugin=$OAT_PASS -passes="oat-pass${OAT_PASS_OPTS:+<$OAT_PASS_OPTS>}" \
+        $OUT/$app.ll -S -o $OUT/${app}_instrumented.ll
+    llc -filetype=obj -relocation-model=pic $OUT/${app}_instrumented.ll -o $OUT/$app.o
+done
+$CC $OUT/drone_test.o $OUT/liboat_soft.a -o $OUT/drone_app -lpthread
+$CC $OUT/drone_test_bad_path.o $OUT/liboat_soft.a -o $OUT/drone_bad_app -lpthread
+
+# 3. Syringe pump (whole-program IR, as in syringe/build_syringe.sh)
+echo "[3/5] Instrumenting syringe pump..."
+for src in syringePump util LiquidCrystal led; do
+    clang -S -emit-llvm -O0 -Xclang -disable-O0-optnone syringe/$src.c -o $OUT/$src.ll
+done
+llvm-link $OUT/syringePump.ll $OUT/util.ll $OUT/LiquidCrystal.ll $OUT/led.ll -S -o $OUT/syringe_combined.ll
+opt -load-pass-plugin=$OAT_PASS -passes="oat-pass${OAT_PASS_OPTS:+<$OAT_PASS_OPTS>}" \
+    $OUT/syringe_combined.ll -S -o $OUT/syringe_instrumented.ll
+llc -filetype=obj -relocation-model=pic $OUT/syringe_instrumented.ll -o $OUT/syringe.o
+
+# 4. Link syringe
+echo "[4/5] Linking syringe_app..."
+$CC $OUT/syringe.o $OUT/liboat_soft.a -o $OUT/syringe_app -lpthread -lm
+
+# 5. Hash benchmark (plain client, no instrumentation)
+echo "[5/5] Building oat_hash_bench..."
+$CC -O2 oat_hash_bench.c $OUT/liboat_soft.a -o $OUT/oat_hash_bench -I$SOFT_TEE -lpthread
+
+echo ""
+echo "DONE! Binaries in '$OUT/':"
+echo "  drone_app, drone_bad_app, syringe_app, oat_hash_bench"
+echo "Simulate world-switch cost with e.g. OAT_SOFT_LATENCY_NS=5000 ./$OUT/drone_app"
@@ -5,6 +5,7 @@
 void __oat_print_proof();
 void __oat_func_enter(int id);
 void __oat_func_exit(int id);
+void __oat_func_exit_sync(int id);
 
 // A helper function to simulate an attack
 void attempt_hack() {
@@ -13,7 +14,8 @@ void attempt_hack() {
     
     // ATTACK: We manually trigger an exit with a random ID (e.g., 9999)
     // The Trusted App expects the ID of 'attempt_hack' (which is NOT 9999)
-    __oat_func_exit(9999); 
+    // Use the synchronous exit so the TA checks it before we return
+    __oat_func_exit_sync(9999); 
 }
 
 int main(int argc, char *argv[]) {
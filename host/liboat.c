@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <tee_client_api.h>
 
 /* --- CONFIGURATION --- */
@@ -16,153 +20,1407 @@
 #define CMD_STACK_POP     0x11
 #define CMD_INDIRECT_CALL 0x12
 #define CMD_GET_LOG 0x13
+#define CMD_EVENT_BATCH   0x14
+#define CMD_HASH_RELEASE  0x16
+#define CMD_HASH_SEAL     0x17
+#define CMD_HASH_PREPARE  0x18
+
+/* Measurement hash backends (must match oat_ta.h) */
+#define OAT_HASH_SHA256   0
+#define OAT_HASH_BLAKE2S  1
+
+/* Batched event records (must match oat_ta.h) */
+#define EVT_BRANCH        0x01
+#define EVT_STACK_PUSH    0x02
+#define EVT_STACK_POP     0x03
+#define EVT_INDIRECT_CALL 0x04
+#define EVT_LOOP          0x05
+#define EVT_INDIRECT_IDX  0x06
+#define EVT_CVI_DEF       0x07
+#define EVT_CVI_USE       0x08
+#define EVT_CVI_FORGET    0x09
+#define EVT_BRANCH_BITS   0x0A
+#define EVT_THREAD_EXIT   0x0B
+#define EVT_PATH          0x0C
+
+/* Thread IDs the TA keeps a shadow stack for, streams (one per thread that
+ * took part) per operation, and the CMD_GET_LOG flag that names a stream
+ * by its thread's ID (must match oat_ta.h) */
+#define OAT_MAX_THREADS   16
+#define OAT_MAX_STREAMS   32
+#define OAT_LOG_THREAD    0x80000000u
+
+/* Operation contexts in the TA: op 0 plus the pool, and the CMD_HASH_SEAL
+ * flag that copies instead of moving (must match oat_ta.h) */
+#define OAT_MAX_OPS       4
+#define OAT_SEAL_COPY     1
+
+/* Table index the pass reports for an unlisted target (must match oat_ta.h) */
+#define OAT_ICALL_UNLISTED 0xFF
+
+struct oat_event {
+    uint32_t tag;
+    uint32_t a;
+    uint32_t b;
+};
+
+/* 512 records = 6 KB, ~9 world switches per syringe bolus instead of ~4400 */
+#define OAT_EVBUF_EVENTS 512
+
+/* Inline branch buffer (oat-pass<inline-log>)
+ * Instrumented code ORs decision i into bit __oat_bits_count of
+ * __oat_bits_word and increments the count; at 64 it calls
+ * __oat_bits_flush(). Every other event drains the pending bits first, so
+ * the TA sees decisions in program order. The symbols are part of the
+ * pass ABI and must keep these names, types and TLS model.
+ */
+__thread uint64_t __oat_bits_word __attribute__((tls_model("initial-exec")));
+__thread uint32_t __oat_bits_count __attribute__((tls_model("initial-exec")));
 
 /* Global Context */
 static TEEC_Context ctx;
 static TEEC_Session sess;
 static int is_initialized = 0;
 
-/* Instrumentation counters (for verifying against paper Table III) */
+/* init_lock: session open and CMD_HASH_INIT.
+ * tee_lock:  every TEE command and the latency stats; the TA runs one
+ *            command at a time anyway.
+ * log_lock:  the export page. */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t tee_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Per-thread event stream
+ * Each application thread appends to its own buffer without locking and
+ * flushes it as a CMD_EVENT_BATCH carrying its thread ID, so the TA keeps
+ * a separate shadow stack and measurement per thread. A thread gets the
+ * lowest free ID on its first event (normally the main thread gets 0) and
+ * gives it back when it exits.
+ *
+ * The buffer is registered once as shared memory so a flush is a single
+ * CMD_EVENT_BATCH with no bounce copy. Falls back to a temp memref if the
+ * registration is refused.
+ */
+struct oat_thread {
+    struct oat_event evbuf[OAT_EVBUF_EVENTS];
+    uint32_t evsite[OAT_EVBUF_EVENTS];  // profiling: site and stack frame
+    uint32_t evframe[OAT_EVBUF_EVENTS]; // that pushed each event
+    uint32_t count;
+    uint32_t tid;
+    uint32_t op_id;     // operation the buffered events belong to
+    TEEC_SharedMemory shm;
+    int registered;
+    /* Hook counts, added to the operation totals at each flush */
+    unsigned long n_branch, n_ret, n_indirect, n_loop, n_path, n_def, n_use;
+    struct oat_prof_thread *prof;   // site profiler share, NULL until a site runs
+};
+
+static __thread struct oat_thread *oat_self;
+static struct oat_thread oat_first_thread;  // thread ID 0, never freed
+static uint32_t oat_tid_mask = 0;           // bit i: thread ID i in use
+static uint32_t oat_op_users[OAT_MAX_OPS];  // attached threads on each op
+static pthread_key_t oat_thread_key;
+
+/* Trace export page, registered as output shared memory: the TA writes
+ * each page of the blob straight into it and it is fwrite()n from there. */
+#define OAT_LOG_PAGE (64 * 1024)
+
+static uint8_t log_page[OAT_LOG_PAGE];
+static TEEC_SharedMemory log_shm;
+static int log_registered = 0;
+
+static int in_exit_flush = 0;
+
+static void oat_flush_events(void);
+static void oat_push_event(uint32_t tag, uint32_t a, uint32_t b);
+
+static void oat_thread_detach(void *arg);
+static void oat_prof_detach(struct oat_thread *t);
+static void oat_lazy_init(void);
+
+/* Move a thread to another operation, keeping oat_op_users in step.
+ * `op_id` may be one the TA will reject; it is not counted then. */
+static void oat_set_op(struct oat_thread *t, uint32_t op_id) {
+    if (t->op_id < OAT_MAX_OPS) __atomic_fetch_sub(&oat_op_users[t->op_id], 1, __ATOMIC_RELEASE);
+    t->op_id = op_id;
+    if (op_id < OAT_MAX_OPS) __atomic_fetch_add(&oat_op_users[op_id], 1, __ATOMIC_ACQ_REL);
+}
+
+static struct oat_thread *oat_thread_attach(void) {
+    uint32_t mask = __atomic_load_n(&oat_tid_mask, __ATOMIC_RELAXED);
+    uint32_t tid;
+    do {
+        if (mask == (1u << OAT_MAX_THREADS) - 1) {
+            fprintf(stderr, "\n[OAT-FATAL] More than %d instrumented threads; the TA cannot attest this one.\n",
+                    OAT_MAX_THREADS);
+            exit(1);
+        }
+        tid = __builtin_ctz(~mask);
+    } while (!__atomic_compare_exchange_n(&oat_tid_mask, &mask, mask | (1u << tid), 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    struct oat_thread *t = tid == 0 ? &oat_first_thread : calloc(1, sizeof(*t));
+    if (!t) {
+        fprintf(stderr, "\n[OAT-FATAL] Out of memory for thread %u event buffer.\n", tid);
+        exit(1);
+    }
+    t->tid = tid;
+    t->count = 0;
+    t->op_id = 0;
+    __atomic_fetch_add(&oat_op_users[0], 1, __ATOMIC_ACQ_REL);
+    t->shm.buffer = t->evbuf;
+    t->shm.size = sizeof(t->evbuf);
+    t->shm.flags = TEEC_MEM_INPUT;
+    pthread_mutex_lock(&tee_lock);
+    t->registered = (TEEC_RegisterSharedMemory(&ctx, &t->shm) == TEEC_SUCCESS);
+    pthread_mutex_unlock(&tee_lock);
+
+    oat_self = t;
+    pthread_setspecific(oat_thread_key, t);
+    return t;
+}
+
+/* pthread key destructor: the thread is exiting. Its pending events are
+ * sent, the TA closes its streams and drops whatever is left on its
+ * shadow stack (frames it left through pthread_exit), so the next owner
+ * of the ID starts clean. */
+static void oat_thread_detach(void *arg) {
+    struct oat_thread *t = arg;
+    uint32_t tid = t->tid;
+
+    oat_push_event(EVT_THREAD_EXIT, 0, 0);
+    oat_flush_events();
+    oat_prof_detach(t);
+
+    pthread_mutex_lock(&tee_lock);
+    if (t->registered) TEEC_ReleaseSharedMemory(&t->shm);
+    pthread_mutex_unlock(&tee_lock);
+
+    oat_self = NULL;
+    if (t->op_id < OAT_MAX_OPS) __atomic_fetch_sub(&oat_op_users[t->op_id], 1, __ATOMIC_RELEASE);
+    if (t != &oat_first_thread) free(t);
+    __atomic_fetch_and(&oat_tid_mask, ~(1u << tid), __ATOMIC_RELEASE);
+}
+
+static inline struct oat_thread *oat_thread(void) {
+    return oat_self ? oat_self : oat_thread_attach();
+}
+
+/* True once a second thread has attached */
+static inline int oat_multithreaded(void) {
+    uint32_t mask = __atomic_load_n(&oat_tid_mask, __ATOMIC_RELAXED);
+    return (mask & (mask - 1)) != 0;
+}
+
+/* OAT_HASH=blake2s selects the in-TA BLAKE2s backend (default SHA-256) */
+static uint32_t hash_alg = OAT_HASH_SHA256;
+
+/* OAT_SYNC_RETURNS=1 makes every __oat_func_exit wait for the TA verdict */
+static int sync_returns = 0;
+
+/* Per-command TEE latency, reset with each operation.
+ * hist[b] counts calls that took [2^b, 2^(b+1)) ns on CLOCK_MONOTONIC.
+ */
+#define OAT_STAT_BUCKETS 32
+
+enum {
+    STAT_HASH_INIT,
+    STAT_HASH_UPDATE,
+    STAT_HASH_FINAL,
+    STAT_STACK_PUSH,
+    STAT_STACK_POP,
+    STAT_INDIRECT_CALL,
+    STAT_GET_LOG,
+    STAT_EVENT_BATCH,
+    STAT_HASH_RELEASE,
+    STAT_HASH_SEAL,
+    STAT_HASH_PREPARE,
+    STAT_COUNT
+};
+
+struct oat_cmd_stat {
+    const char *name;
+    uint32_t cmd;
+    uint64_t calls;
+    uint64_t events;    // records carried (EVENT_BATCH only)
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t hist[OAT_STAT_BUCKETS];
+};
+
+static struct oat_cmd_stat cmd_stats[STAT_COUNT] = {
+    [STAT_HASH_INIT]     = { "HASH_INIT",     CMD_HASH_INIT },
+    [STAT_HASH_UPDATE]   = { "HASH_UPDATE",   CMD_HASH_UPDATE },
+    [STAT_HASH_FINAL]    = { "HASH_FINAL",    CMD_HASH_FINAL },
+    [STAT_STACK_PUSH]    = { "STACK_PUSH",    CMD_STACK_PUSH },
+    [STAT_STACK_POP]     = { "STACK_POP",     CMD_STACK_POP },
+    [STAT_INDIRECT_CALL] = { "INDIRECT_CALL", CMD_INDIRECT_CALL },
+    [STAT_GET_LOG]       = { "GET_LOG",       CMD_GET_LOG },
+    [STAT_EVENT_BATCH]   = { "EVENT_BATCH",   CMD_EVENT_BATCH },
+    [STAT_HASH_RELEASE]  = { "HASH_RELEASE",  CMD_HASH_RELEASE },
+    [STAT_HASH_SEAL]     = { "HASH_SEAL",     CMD_HASH_SEAL },
+    [STAT_HASH_PREPARE]  = { "HASH_PREPARE",  CMD_HASH_PREPARE },
+};
+
+static unsigned long oat_op_seq = 0;
+
+/* Instrumentation counters (for verifying against paper Table III).
+ * Totals over all threads; a thread's hooks count once it has flushed. */
 static unsigned long oat_count_branch = 0;
 static unsigned long oat_count_ret = 0;
 static unsigned long oat_count_indirect = 0;
+static unsigned long oat_count_loop = 0;
+static unsigned long oat_count_path = 0;
+static unsigned long oat_count_def = 0;
+static unsigned long oat_count_use = 0;
+
+/* The counters as printed with one operation's proof */
+struct oat_counts {
+    unsigned long branch, ret, indirect, loop, path, def, use;
+};
+
+static void oat_snapshot_counts(struct oat_counts *c) {
+    c->branch = __atomic_load_n(&oat_count_branch, __ATOMIC_RELAXED);
+    c->ret = __atomic_load_n(&oat_count_ret, __ATOMIC_RELAXED);
+    c->indirect = __atomic_load_n(&oat_count_indirect, __ATOMIC_RELAXED);
+    c->loop = __atomic_load_n(&oat_count_loop, __ATOMIC_RELAXED);
+    c->path = __atomic_load_n(&oat_count_path, __ATOMIC_RELAXED);
+    c->def = __atomic_load_n(&oat_count_def, __ATOMIC_RELAXED);
+    c->use = __atomic_load_n(&oat_count_use, __ATOMIC_RELAXED);
+}
+
+static uint64_t oat_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void oat_reset_stats(void) {
+    for (int i = 0; i < STAT_COUNT; i++) {
+        struct oat_cmd_stat *st = &cmd_stats[i];
+        st->calls = st->events = st->total_ns = st->max_ns = 0;
+        st->min_ns = UINT64_MAX;
+        memset(st->hist, 0, sizeof(st->hist));
+    }
+}
+
+static __thread uint64_t oat_last_ns;  // duration of this thread's last command
+
+/* Every TEE command goes through here so it shows up in the stats */
+static TEEC_Result oat_invoke(int stat, TEEC_Operation *op, uint32_t events) {
+    struct oat_cmd_stat *st = &cmd_stats[stat];
+    pthread_mutex_lock(&tee_lock);
+    uint64_t t0 = oat_now_ns();
+    TEEC_Result res = TEEC_InvokeCommand(&sess, st->cmd, op, NULL);
+    uint64_t ns = oat_now_ns() - t0;
+    oat_last_ns = ns;
+
+    int b = ns > 1 ? 63 - __builtin_clzll(ns) : 0;
+    if (b >= OAT_STAT_BUCKETS) b = OAT_STAT_BUCKETS - 1;
+
+    st->calls++;
+    st->events += events;
+    st->total_ns += ns;
+    if (ns < st->min_ns) st->min_ns = ns;
+    if (ns > st->max_ns) st->max_ns = ns;
+    st->hist[b]++;
+    pthread_mutex_unlock(&tee_lock);
+    return res;
+}
+
+static void oat_fatal_exit(void) {
+    if (in_exit_flush) {
+        // exit() must not be re-entered from an atexit handler
+        fflush(stdout);
+        _exit(1);
+    }
+    exit(1);
+}
+
+/* Site profiler (oat-pass<profile>)
+ * The pass puts __oat_prof_site(id) before every hook call and names the
+ * sites in __oat_site_table. Hits are counted per site and per call stack,
+ * a tree of functions grown from the enter/exit sites; a function without
+ * them (elided leaf) shows up under its caller. The TEE time of each
+ * batch is split evenly over the events it carried, each charged to the
+ * site and stack that pushed it. At exit the report goes to $OAT_PROFILE
+ * (default oat_profile.txt) and the stacks, folded for flamegraph tools,
+ * to "<that>.folded". Without the table none of this runs.
+ *
+ * Each thread counts into its own struct oat_prof_thread, so the hooks
+ * share no lock or cache line. Its lock is only ever contended by
+ * __oat_profile_dump(), which adds up the live threads and what exited
+ * threads left in prof_sites/prof_tree.
+ */
+extern const uint8_t __oat_site_table[] __attribute__((weak));
+
+enum { PROF_OTHER, PROF_ENTER, PROF_EXIT };
+
+struct oat_prof_site {
+    const char *name;       // "function:kind[:line]"
+    uint32_t func;          // index into prof_funcs
+    int kind;
+    uint64_t hits, tee_ns;  // of exited threads
+};
+
+struct oat_prof_frame {
+    uint32_t parent, func;  // frame 0 is the root, func UINT32_MAX
+    uint32_t child, sibling;
+    uint64_t hits, tee_ns;
+};
+
+// Frames are appended after their parent, so parents come first
+struct oat_prof_tree {
+    struct oat_prof_frame *frames;
+    uint32_t n, cap;
+};
+
+struct oat_prof_thread {
+    pthread_mutex_t lock;   // owner while counting, __oat_profile_dump() while reading
+    uint64_t *hits, *tee_ns; // per site
+    struct oat_prof_tree tree;
+    uint32_t site_cur;      // site of the hook being run
+    uint32_t frame_cur;     // ... and the frame it was charged to
+    uint32_t top;           // innermost entered frame
+};
+
+static struct oat_prof_site *prof_sites;    // [0]: events pushed by no site
+static uint32_t prof_nsites = 0;
+static char **prof_funcs;
+static uint32_t prof_nfuncs = 0;
+static struct oat_prof_tree prof_tree;      // of exited threads
+static pthread_once_t prof_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER; // the two above and prof_live
+static struct oat_prof_thread *prof_live[OAT_MAX_THREADS];   // by thread ID
+
+static uint32_t oat_prof_func(const char *name, size_t len) {
+    for (uint32_t i = 0; i < prof_nfuncs; i++)
+        if (strlen(prof_funcs[i]) == len && memcmp(prof_funcs[i], name, len) == 0) return i;
+    prof_funcs[prof_nfuncs] = strndup(name, len);
+    return prof_nfuncs++;
+}
+
+static int oat_prof_tree_init(struct oat_prof_tree *tree, uint32_t cap) {
+    tree->frames = calloc(cap, sizeof(*tree->frames));
+    if (!tree->frames) return -1;
+    tree->frames[0].func = UINT32_MAX;
+    tree->n = 1;
+    tree->cap = cap;
+    return 0;
+}
+
+static uint32_t oat_prof_child(struct oat_prof_tree *tree, uint32_t parent, uint32_t func) {
+    for (uint32_t c = tree->frames[parent].child; c; c = tree->frames[c].sibling)
+        if (tree->frames[c].func == func) return c;
+    if (tree->n == tree->cap) {
+        uint32_t cap = tree->cap * 2;
+        struct oat_prof_frame *frames = realloc(tree->frames, cap * sizeof(*frames));
+        if (!frames) return parent;
+        tree->frames = frames;
+        tree->cap = cap;
+    }
+    uint32_t c = tree->n++;
+    tree->frames[c] = (struct oat_prof_frame){ parent, func, 0, tree->frames[parent].child, 0, 0 };
+    tree->frames[parent].child = c;
+    return c;
+}
+
+/* Add one thread's counts to `hits`/`ns` (per site) and its frames to
+ * `tree`, matching frames by their chain of functions */
+static void oat_prof_merge(uint64_t *hits, uint64_t *ns, struct oat_prof_tree *tree,
+                           const struct oat_prof_thread *p) {
+    for (uint32_t i = 0; i <= prof_nsites; i++) {
+        hits[i] += p->hits[i];
+        ns[i] += p->tee_ns[i];
+    }
+    uint32_t *map = malloc(p->tree.n * sizeof(uint32_t));
+    if (!map) return;
+    map[0] = 0;
+    for (uint32_t fr = 1; fr < p->tree.n; fr++) {
+        const struct oat_prof_frame *f = &p->tree.frames[fr];
+        map[fr] = oat_prof_child(tree, map[f->parent], f->func);
+        tree->frames[map[fr]].hits += f->hits;
+        tree->frames[map[fr]].tee_ns += f->tee_ns;
+    }
+    free(map);
+}
+
+// "OATS" | uint16 count | { uint16 id, uint16 len, char name[len] }*
+static void oat_prof_load(void) {
+    const uint8_t *p = __oat_site_table;
+    if (!p || memcmp(p, "OATS", 4) != 0) return;
+    uint32_t n = p[4] | p[5] << 8;
+    p += 6;
+
+    prof_sites = calloc(n + 1, sizeof(*prof_sites));
+    prof_funcs = calloc(n + 1, sizeof(*prof_funcs));
+    if (!prof_sites || !prof_funcs || oat_prof_tree_init(&prof_tree, 256) != 0) return;
+
+    prof_sites[0].name = "(runtime)";
+    prof_sites[0].func = oat_prof_func("(runtime)", 9);
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t id = p[0] | p[1] << 8, len = p[2] | p[3] << 8;
+        const char *name = (const char *)p + 4;
+        p += 4 + len;
+        if (id == 0 || id > n) continue;
+
+        struct oat_prof_site *s = &prof_sites[id];
+        s->name = strndup(name, len);
+        const char *colon = memchr(name, ':', len);
+        s->func = oat_prof_func(name, colon ? (size_t)(colon - name) : len);
+        s->kind = strstr(s->name, ":enter") ? PROF_ENTER :
+                  strstr(s->name, ":exit") ? PROF_EXIT : PROF_OTHER;
+    }
+    prof_nsites = n;
+}
+
+/* The calling thread's profile, registered in prof_live on first use
+ * (NULL if out of memory: its sites then go uncounted) */
+static struct oat_prof_thread *oat_prof_self(struct oat_thread *t) {
+    if (t->prof) return t->prof;
+    struct oat_prof_thread *p = calloc(1, sizeof(*p));
+    if (!p) return NULL;
+    p->hits = calloc(prof_nsites + 1, sizeof(uint64_t));
+    p->tee_ns = calloc(prof_nsites + 1, sizeof(uint64_t));
+    if (!p->hits || !p->tee_ns || oat_prof_tree_init(&p->tree, 64) != 0) {
+        free(p->hits); free(p->tee_ns); free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+
+    pthread_mutex_lock(&prof_lock);
+    prof_live[t->tid] = p;
+    pthread_mutex_unlock(&prof_lock);
+    return t->prof = p;
+}
+
+/* Thread exit: its counts stay in the totals, the rest is freed */
+static void oat_prof_detach(struct oat_thread *t) {
+    struct oat_prof_thread *p = t->prof;
+    if (!p) return;
+    pthread_mutex_lock(&prof_lock);
+    uint64_t *hits = calloc(prof_nsites + 1, sizeof(uint64_t));
+    uint64_t *ns = calloc(prof_nsites + 1, sizeof(uint64_t));
+    if (hits && ns) {
+        oat_prof_merge(hits, ns, &prof_tree, p);
+        for (uint32_t i = 0; i <= prof_nsites; i++) {
+            prof_sites[i].hits += hits[i];
+            prof_sites[i].tee_ns += ns[i];
+        }
+    }
+    prof_live[t->tid] = NULL;
+    pthread_mutex_unlock(&prof_lock);
+
+    free(hits); free(ns);
+    pthread_mutex_destroy(&p->lock);
+    free(p->hits); free(p->tee_ns); free(p->tree.frames); free(p);
+    t->prof = NULL;
+}
+
+void __oat_prof_site(int id) {
+    pthread_once(&prof_once, oat_prof_load);
+    if (id <= 0 || (uint32_t)id > prof_nsites) return;
+    if (!is_initialized) oat_lazy_init();
+    struct oat_prof_thread *p = oat_prof_self(oat_thread());
+    if (!p) return;
+    int kind = prof_sites[id].kind;
+    uint32_t func = prof_sites[id].func;
+
+    pthread_mutex_lock(&p->lock);
+    // Every enter is a new frame, so recursion nests
+    uint32_t fr = p->top;
+    if (kind == PROF_ENTER || p->tree.frames[fr].func != func)
+        fr = oat_prof_child(&p->tree, fr, func);
+    p->hits[id]++;
+    p->tree.frames[fr].hits++;
+    p->site_cur = (uint32_t)id;
+    p->frame_cur = fr;
+    if (kind == PROF_ENTER) p->top = fr;
+    else if (kind == PROF_EXIT) p->top = p->tree.frames[fr].parent;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void oat_prof_charge(struct oat_thread *t, uint32_t count, uint64_t ns) {
+    struct oat_prof_thread *p = oat_prof_self(t);
+    if (!p) return;
+    uint64_t each = ns / count;
+    pthread_mutex_lock(&p->lock);
+    for (uint32_t i = 0; i < count; i++) {
+        p->tee_ns[t->evsite[i]] += each;
+        p->tree.frames[t->evframe[i]].tee_ns += each;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+static const uint64_t *prof_sort_hits, *prof_sort_ns;
+
+static int oat_prof_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    if (prof_sort_hits[x] != prof_sort_hits[y]) return prof_sort_hits[x] < prof_sort_hits[y] ? 1 : -1;
+    if (prof_sort_ns[x] != prof_sort_ns[y]) return prof_sort_ns[x] < prof_sort_ns[y] ? 1 : -1;
+    return x < y ? -1 : x > y;
+}
+
+/* Write the report (sites, then functions, by hits) to `filename` and the
+ * stacks to "<filename>.folded", one "f1;f2;...;fn hits" line per stack.
+ * Returns 0 on success, -1 without a site table or on I/O errors. */
+int __oat_profile_dump(const char *filename) {
+    pthread_once(&prof_once, oat_prof_load);
+    if (!prof_nsites) return -1;
+
+    char folded_name[4096];
+    snprintf(folded_name, sizeof(folded_name), "%s.folded", filename);
+    FILE *f = fopen(filename, "w");
+    FILE *ff = fopen(folded_name, "w");
+    if (!f || !ff) {
+        printf("[OAT] Error opening profile file '%s'.\n", f ? folded_name : filename);
+        if (f) fclose(f);
+        if (ff) fclose(ff);
+        return -1;
+    }
+
+    // Exited threads, then every live one as of now
+    pthread_mutex_lock(&prof_lock);
+    uint32_t n = prof_nsites + 1;
+    uint64_t *hits = calloc(n + prof_nfuncs, sizeof(uint64_t));
+    uint64_t *ns = calloc(n + prof_nfuncs, sizeof(uint64_t));
+    uint32_t *order = calloc(n > prof_nfuncs ? n : prof_nfuncs, sizeof(uint32_t));
+    struct oat_prof_tree tree = { malloc(prof_tree.cap * sizeof(*tree.frames)), prof_tree.n, prof_tree.cap };
+    uint32_t *chain = NULL;
+    if (hits && ns && tree.frames) {
+        memcpy(tree.frames, prof_tree.frames, prof_tree.n * sizeof(*tree.frames));
+        for (uint32_t i = 0; i < n; i++) {
+            hits[i] = prof_sites[i].hits;
+            ns[i] = prof_sites[i].tee_ns;
+        }
+        for (uint32_t tid = 0; tid < OAT_MAX_THREADS; tid++) {
+            struct oat_prof_thread *p = prof_live[tid];
+            if (!p) continue;
+            pthread_mutex_lock(&p->lock);
+            oat_prof_merge(hits, ns, &tree, p);
+            pthread_mutex_unlock(&p->lock);
+        }
+        chain = calloc(tree.n, sizeof(uint32_t));
+    }
+    pthread_mutex_unlock(&prof_lock);
+    if (!order || !chain) {
+        free(hits); free(ns); free(order); free(chain); free(tree.frames);
+        fclose(f);
+        fclose(ff);
+        return -1;
+    }
+
+    uint64_t total_hits = 0, total_ns = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        hits[n + prof_sites[i].func] += hits[i];
+        ns[n + prof_sites[i].func] += ns[i];
+        total_hits += hits[i];
+        total_ns += ns[i];
+    }
+
+    fprintf(f, "# OAT site profile: %llu hook calls, %llu ns in TEE event batches\n",
+            (unsigned long long)total_hits, (unsigned long long)total_ns);
+    fprintf(f, "#%7s %12s %14s  %s\n", "site", "hits", "tee_ns", "function:kind[:line]");
+    for (uint32_t i = 0; i < n; i++) order[i] = i;
+    prof_sort_hits = hits;
+    prof_sort_ns = ns;
+    qsort(order, n, sizeof(uint32_t), oat_prof_cmp);
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t id = order[i];
+        if (!hits[id] && !ns[id]) continue;
+        fprintf(f, "%8u %12llu %14llu  %s\n", id, (unsigned long long)hits[id],
+                (unsigned long long)ns[id], prof_sites[id].name ? prof_sites[id].name : "?");
+    }
+
+    fprintf(f, "\n#%20s %14s  %s\n", "hits", "tee_ns", "function");
+    for (uint32_t i = 0; i < prof_nfuncs; i++) order[i] = i;
+    prof_sort_hits = hits + n;
+    prof_sort_ns = ns + n;
+    qsort(order, prof_nfuncs, sizeof(uint32_t), oat_prof_cmp);
+    for (uint32_t i = 0; i < prof_nfuncs; i++) {
+        uint32_t fn = order[i];
+        if (!hits[n + fn] && !ns[n + fn]) continue;
+        fprintf(f, "%21llu %14llu  %s\n", (unsigned long long)hits[n + fn],
+                (unsigned long long)ns[n + fn], prof_funcs[fn]);
+    }
+
+    for (uint32_t fr = 1; fr < tree.n; fr++) {
+        if (!tree.frames[fr].hits) continue;
+        uint32_t depth = 0;
+        for (uint32_t c = fr; c; c = tree.frames[c].parent) chain[depth++] = c;
+        while (depth--) fprintf(ff, "%s%s", prof_funcs[tree.frames[chain[depth]].func], depth ? ";" : "");
+        fprintf(ff, " %llu\n", (unsigned long long)tree.frames[fr].hits);
+    }
+
+    free(hits); free(ns); free(order); free(chain); free(tree.frames);
+    int err = ferror(f) || ferror(ff);
+    err |= fclose(f) != 0;
+    err |= fclose(ff) != 0;
+    return err ? -1 : 0;
+}
+
+/* Hand every event the calling thread has buffered to the TA in one
+ * CMD_EVENT_BATCH. A shadow-stack mismatch anywhere in the batch is
+ * fatal, exactly as it is for a single CMD_STACK_POP.
+ */
+static void oat_drain_bits(void);
+
+static void oat_flush_events(void) {
+    oat_drain_bits();
+    struct oat_thread *t = oat_self;
+    if (!t || t->count == 0) return;
+
+    TEEC_Operation op = {0};
+    uint32_t bytes = t->count * sizeof(struct oat_event);
+
+    if (t->registered) {
+        op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT, TEEC_VALUE_OUTPUT, TEEC_VALUE_INPUT, TEEC_NONE);
+        op.params[0].memref.parent = &t->shm;
+        op.params[0].memref.offset = 0;
+        op.params[0].memref.size = bytes;
+    } else {
+        op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_VALUE_OUTPUT, TEEC_VALUE_INPUT, TEEC_NONE);
+        op.params[0].tmpref.buffer = t->evbuf;
+        op.params[0].tmpref.size = bytes;
+    }
+    op.params[2].value.a = t->tid;
+    op.params[2].value.b = t->op_id;
+
+    TEEC_Result res = oat_invoke(STAT_EVENT_BATCH, &op, t->count);
+    if (prof_nsites) oat_prof_charge(t, t->count, oat_last_ns);
+    t->count = 0;
+
+    __atomic_fetch_add(&oat_count_branch, t->n_branch, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&oat_count_ret, t->n_ret, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&oat_count_indirect, t->n_indirect, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&oat_count_loop, t->n_loop, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&oat_count_path, t->n_path, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&oat_count_def, t->n_def, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&oat_count_use, t->n_use, __ATOMIC_RELAXED);
+    t->n_branch = t->n_ret = t->n_indirect = t->n_loop = t->n_path = t->n_def = t->n_use = 0;
+
+    if (res == TEEC_ERROR_SECURITY) {
+        if (op.params[1].value.b == EVT_INDIRECT_IDX)
+            fprintf(stderr, "\n[OAT-FATAL] CFI VIOLATION! TEE blocked indirect call outside its target table (batch event %u).\n",
+                    op.params[1].value.a);
+        else if (op.params[1].value.b == EVT_CVI_USE)
+            fprintf(stderr, "\n[OAT-FATAL] DATA ATTACK DETECTED! Sensitive variable changed outside its attested stores (batch event %u).\n",
+                    op.params[1].value.a);
+        else
+            fprintf(stderr, "\n[OAT-FATAL] ROP ATTACK DETECTED! TEE blocked return (thread %u, batch event %u).\n",
+                    t->tid, op.params[1].value.a);
+        oat_fatal_exit();
+    } else if (res != TEEC_SUCCESS && op.params[1].value.b == EVT_STACK_PUSH) {
+        // Past OAT_STACK_SPILL_LIMIT, or no heap left: later returns cannot be checked
+        if (res == TEEC_ERROR_OUT_OF_MEMORY)
+            fprintf(stderr, "\n[OAT-FATAL] TEE heap exhausted, shadow stack cannot grow (thread %u, batch event %u).\n",
+                    t->tid, op.params[1].value.a);
+        else
+            fprintf(stderr, "\n[OAT-FATAL] Call chain too deep for the TEE shadow stack (thread %u, batch event %u, 0x%x).\n",
+                    t->tid, op.params[1].value.a, res);
+        oat_fatal_exit();
+    } else if (res != TEEC_SUCCESS) {
+        printf("[OAT] Event batch rejected: 0x%x\n", res);
+    }
+}
+
+static void oat_push_event(uint32_t tag, uint32_t a, uint32_t b) {
+    if (tag != EVT_BRANCH_BITS && __oat_bits_count) oat_drain_bits();
+    struct oat_thread *t = oat_thread();
+    if (t->count == OAT_EVBUF_EVENTS) oat_flush_events();
+    t->evbuf[t->count].tag = tag;
+    t->evbuf[t->count].a = a;
+    t->evbuf[t->count].b = b;
+    if (prof_nsites) {
+        t->evsite[t->count] = t->prof ? t->prof->site_cur : 0;
+        t->evframe[t->count] = t->prof ? t->prof->frame_cur : 0;
+    }
+    t->count++;
+}
+
+/* Pending inline decisions become up to two EVT_BRANCH_BITS records
+ * (a = decisions LSB-first, b = how many). The buffer is cleared before
+ * pushing, so a flush triggered by the push does not drain it again. */
+static void oat_drain_bits(void) {
+    uint32_t n = __oat_bits_count;
+    uint64_t w = __oat_bits_word;
+    if (n == 0) return;
+
+    __oat_bits_count = 0;
+    __oat_bits_word = 0;
+    oat_push_event(EVT_BRANCH_BITS, (uint32_t)w, n < 32 ? n : 32);
+    if (n > 32) oat_push_event(EVT_BRANCH_BITS, (uint32_t)(w >> 32), n - 32);
+    oat_self->n_branch += n;
+}
+
+/* Returns still queued when the program ends are checked too (those of
+ * the exiting thread; other threads are expected to have joined) */
+static void oat_quote_drain(void);
+
+static void oat_flush_at_exit(void) {
+    in_exit_flush = 1;
+    oat_flush_events();
+    oat_quote_drain();
+
+    if (prof_nsites) {
+        const char *name = getenv("OAT_PROFILE");
+        if (!name || !name[0]) name = "oat_profile.txt";
+        if (__oat_profile_dump(name) == 0)
+            printf("[OAT] Site profile saved to '%s' and '%s.folded'\n", name, name);
+    }
+}
 
 /* Initialize / Reset Session
  * Paper's cfv_init() starts a fresh measurement each time.
- * First call: open TEE context + session.
+ * First call (normally __oat_runtime_start() at load): open TEE context +
+ * session and have the TA preallocate every operation's state.
  * Subsequent calls: re-invoke CMD_HASH_INIT to reset the TA state
- * (shadow stack, hash, log) without reopening the session.
+ * (hash, log of every thread) without reopening the session.
+ * Only the calling thread's pending events are flushed first, so other
+ * threads should be idle (or call __oat_thread_flush()) at the boundary.
  */
-void __oat_init() {
+static void oat_start_operation(void) {
     uint32_t err_origin;
+    int first = !is_initialized;
 
     if (!is_initialized) {
         TEEC_UUID uuid = TA_OAT_UUID;
         TEEC_InitializeContext(NULL, &ctx);
         TEEC_OpenSession(&ctx, &sess, &uuid, TEEC_LOGIN_PUBLIC, NULL, NULL, &err_origin);
+
+        pthread_key_create(&oat_thread_key, oat_thread_detach);
+
+        log_shm.buffer = log_page;
+        log_shm.size = sizeof(log_page);
+        log_shm.flags = TEEC_MEM_OUTPUT;
+        log_registered = (TEEC_RegisterSharedMemory(&ctx, &log_shm) == TEEC_SUCCESS);
+
+        const char *env = getenv("OAT_SYNC_RETURNS");
+        sync_returns = (env && env[0] == '1');
+        atexit(oat_flush_at_exit);
+
+        env = getenv("OAT_HASH");
+        if (env && strcmp(env, "blake2s") == 0) hash_alg = OAT_HASH_BLAKE2S;
+
+        /* Every operation context's digests and trace buffers are allocated
+         * now, for OAT_THREADS threads (default 1), so each later
+         * CMD_HASH_INIT only resets them. Threads beyond that allocate on
+         * first use. */
+        env = getenv("OAT_THREADS");
+        int threads = env ? atoi(env) : 1;
+        if (threads < 1 || threads > OAT_MAX_THREADS) threads = 1;
+        TEEC_Operation prep = {0};
+        prep.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+        prep.params[0].value.a = hash_alg;
+        prep.params[0].value.b = (uint32_t)threads;
+        TEEC_Result res = oat_invoke(STAT_HASH_PREPARE, &prep, 0);
+        if (res != TEEC_SUCCESS)
+            printf("[OAT] TA state not preallocated (0x%x), allocating on first use.\n", res);
+
         is_initialized = 1;
-        printf("[OAT] Secure Session Established.\n");
+        printf("[OAT] Secure Session Established (%s).\n",
+               hash_alg == OAT_HASH_BLAKE2S ? "BLAKE2s" : "SHA-256");
     }
 
-    /* Reset TA state (hash, shadow stack, log) for new operation */
-    TEEC_InvokeCommand(&sess, CMD_HASH_INIT, NULL, NULL);
+    /* Shadow-stack events from outside the operation still have to reach
+     * the TA before the hash is reset. On the first (possibly lazy) init,
+     * inline decisions recorded so far belong to this operation. */
+    struct oat_thread *t = oat_thread();
+    if (!first) oat_flush_events();
+    oat_set_op(t, 0);
+
+    /* Latency stats cover this operation from its HASH_INIT on */
+    pthread_mutex_lock(&tee_lock);
+    oat_reset_stats();
+    oat_op_seq++;
+    pthread_mutex_unlock(&tee_lock);
+
+    /* Reset TA state (hash, log) for new operation, measured from here
+     * by the calling thread */
+    TEEC_Operation op = {0};
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_VALUE_INPUT, TEEC_NONE);
+    op.params[0].value.a = hash_alg;
+    op.params[2].value.a = t->tid;
+    oat_invoke(STAT_HASH_INIT, &op, 0);
 
     /* Reset host-side counters */
     oat_count_branch = 0;
     oat_count_ret = 0;
     oat_count_indirect = 0;
+    oat_count_loop = 0;
+    oat_count_path = 0;
+    oat_count_def = 0;
+    oat_count_use = 0;
+}
+
+void __oat_init() {
+    pthread_mutex_lock(&init_lock);
+    oat_start_operation();
+    pthread_mutex_unlock(&init_lock);
+}
+
+/* First hook of the program: only one thread may start the operation */
+static void oat_lazy_init(void) {
+    pthread_mutex_lock(&init_lock);
+    if (!is_initialized) oat_start_operation();
+    pthread_mutex_unlock(&init_lock);
+}
+
+/* Explicit startup: open the session, have the TA allocate what every
+ * operation needs, and start operation 0, so that neither the first hook
+ * nor the first __oat_init() pays for any of it. Runs as a constructor
+ * unless OAT_LAZY_START=1; later calls do nothing. */
+void __oat_runtime_start(void) {
+    oat_lazy_init();
+}
+
+__attribute__((constructor)) static void oat_runtime_ctor(void) {
+    const char *env = getenv("OAT_LAZY_START");
+    if (!(env && env[0] == '1')) __oat_runtime_start();
+}
+
+/* Operation the calling thread measures into (0: the __oat_init one) */
+static uint32_t oat_current_op(void) {
+    return oat_self ? oat_self->op_id : 0;
+}
+
+/* Overlapping operations
+ * __oat_op_begin() starts a new operation in the TA, independent of the
+ * __oat_init() one and of each other, and returns its ID (-1 if the TA's
+ * OAT_MAX_OPS - 1 contexts are all in use). From then on the calling
+ * thread's events, __oat_print_proof() and __oat_export_log() go to that
+ * operation; __oat_op_select() moves a thread between operations and
+ * __oat_op_end() hands the context back. Pending events are flushed at
+ * each switch, so every batch belongs to exactly one operation.
+ */
+int __oat_op_begin(void) {
+    if (!is_initialized) oat_lazy_init();
+    struct oat_thread *t = oat_thread();
+    oat_flush_events();
+
+    TEEC_Operation op = {0};
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT, TEEC_VALUE_INPUT, TEEC_NONE);
+    op.params[0].value.a = hash_alg;
+    op.params[2].value.a = t->tid;
+    TEEC_Result res = oat_invoke(STAT_HASH_INIT, &op, 0);
+    if (res != TEEC_SUCCESS) {
+        printf("[OAT] Cannot start operation: 0x%x\n", res);
+        return -1;
+    }
+    oat_set_op(t, op.params[1].value.a);
+    return (int)t->op_id;
+}
+
+void __oat_op_select(int op_id) {
+    if (!is_initialized) oat_lazy_init();
+    struct oat_thread *t = oat_thread();
+    oat_flush_events();
+    oat_set_op(t, (uint32_t)op_id);
+}
+
+void __oat_op_end(int op_id) {
+    if (!is_initialized || op_id <= 0) return;
+    oat_flush_events();
+
+    TEEC_Operation op = {0};
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+    op.params[0].value.a = (uint32_t)op_id;
+    oat_invoke(STAT_HASH_RELEASE, &op, 0);
+    if (oat_self && oat_self->op_id == (uint32_t)op_id) oat_set_op(oat_self, 0);
 }
 
 /* 1. Branch Logging */
 void __oat_log(int val) {
-    if (!is_initialized) __oat_init();
-    TEEC_Operation op = {0};
-    char buffer[2]; 
-    sprintf(buffer, "%d", val);
-    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
-    op.params[0].tmpref.buffer = buffer;
-    op.params[0].tmpref.size = 1;
-    TEEC_InvokeCommand(&sess, CMD_HASH_UPDATE, &op, NULL);
-    oat_count_branch++;
+    if (!is_initialized) oat_lazy_init();
+    oat_push_event(EVT_BRANCH, val, 0);
+    oat_self->n_branch++;
 }
 
 /* 2. Indirect Jump Logging (NEW) */
 void __oat_log_indirect(uint64_t target_addr) {
-    if (!is_initialized) __oat_init();
-    TEEC_Operation op = {0};
-    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
-    
+    if (!is_initialized) oat_lazy_init();
+
     // Split 64-bit address into two 32-bit halves
-    op.params[0].value.a = (uint32_t)(target_addr & 0xFFFFFFFF);
-    op.params[0].value.b = (uint32_t)(target_addr >> 32);
+    oat_push_event(EVT_INDIRECT_CALL, (uint32_t)(target_addr & 0xFFFFFFFF),
+                   (uint32_t)(target_addr >> 32));
+    oat_self->n_indirect++;
+}
+
+/* 1b. Inline branch buffer full (oat-pass<inline-log>) */
+void __oat_bits_flush(void) {
+    if (!is_initialized) oat_lazy_init();
+    oat_drain_bits();
+}
+
+/* 2a. Indirect Call by Table Index
+ * The pass gives each indirect call site a table of the functions it may
+ * reach and reports the target's index in it. An unlisted target is sent
+ * at once, so the TA stops the program before the call is made.
+ */
+void __oat_log_indirect_idx(int site, int idx) {
+    if (!is_initialized) oat_lazy_init();
+    oat_push_event(EVT_INDIRECT_IDX, site, idx);
+    oat_self->n_indirect++;
+    if (idx == OAT_ICALL_UNLISTED) oat_flush_events();
+}
+
+/* 2b. Compressed Loop (oat-pass<loop-compress>)
+ * One event per loop exit instead of one branch event per iteration.
+ */
+void __oat_log_loop(int site, int trips) {
+    if (!is_initialized) oat_lazy_init();
+    oat_push_event(EVT_LOOP, site, trips);
+    oat_self->n_loop++;
+}
+
+/* 2c. Acyclic Path (oat-pass<path-log>)
+ * One event per Ball-Larus path, at a back edge or return, instead of one
+ * per branch along it.
+ */
+void __oat_log_path(int site, int path) {
+    if (!is_initialized) oat_lazy_init();
+    oat_push_event(EVT_PATH, site, path);
+    oat_self->n_path++;
+}
+
+/* 2d. Critical Variable Integrity (annotate("sensitive") globals)
+ * Stores report the value written, loads the value read, keyed by
+ * variable ID and byte offset. Batched like returns: the TA checks each
+ * use against the last def and fails the batch on a mismatch. The TA's
+ * copy is shared by all threads, so once there is more than one thread
+ * each def/use is sent at once to reach it in the order it happened.
+ */
+void __oat_cvi_def(int var, int offset, int value) {
+    if (!is_initialized) oat_lazy_init();
+    oat_push_event(EVT_CVI_DEF, ((uint32_t)offset << 16) | (uint16_t)var, value);
+    oat_self->n_def++;
+    if (oat_multithreaded()) oat_flush_events();
+}
+
+void __oat_cvi_use(int var, int offset, int value) {
+    if (!is_initialized) oat_lazy_init();
+    oat_push_event(EVT_CVI_USE, ((uint32_t)offset << 16) | (uint16_t)var, value);
+    oat_self->n_use++;
+    if (oat_multithreaded()) oat_flush_events();
+}
 
-    TEEC_InvokeCommand(&sess, CMD_INDIRECT_CALL, &op, NULL);
-    oat_count_indirect++;
+/* A call received a pointer into the variable and may have written it */
+void __oat_cvi_forget(int var) {
+    if (!is_initialized) oat_lazy_init();
+    oat_push_event(EVT_CVI_FORGET, var, 0);
+    if (oat_multithreaded()) oat_flush_events();
 }
 
 /* 3. Shadow Stack: Entry */
 void __oat_func_enter(int func_id) {
-    if (!is_initialized) __oat_init();
-    TEEC_Operation op = {0};
-    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
-    op.params[0].value.a = func_id;
-    TEEC_InvokeCommand(&sess, CMD_STACK_PUSH, &op, NULL);
+    if (!is_initialized) oat_lazy_init();
+    oat_push_event(EVT_STACK_PUSH, func_id, 0);
 }
 
-/* 4. Shadow Stack: Exit */
+/* 4. Shadow Stack: Exit
+ * The pop is queued and checked when the batch is flushed; a mismatch
+ * still aborts the program before the operation's proof is produced.
+ */
 void __oat_func_exit(int func_id) {
     if (!is_initialized) return;
-    TEEC_Operation op = {0};
-    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
-    op.params[0].value.a = func_id;
-    TEEC_Result res = TEEC_InvokeCommand(&sess, CMD_STACK_POP, &op, NULL);
-    oat_count_ret++;
+    oat_push_event(EVT_STACK_POP, func_id, 0);
+    oat_self->n_ret++;
 
-    if (res != TEEC_SUCCESS) {
-        fprintf(stderr, "\n[OAT-FATAL] ROP ATTACK DETECTED! TEE blocked return.\n");
-        exit(1); 
-    }
+    if (sync_returns) oat_flush_events();
 }
 
-void __oat_get_execution_log(uint8_t *buffer, uint32_t *size) {
-    TEEC_Operation op = {0};
-    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
-    op.params[0].tmpref.buffer = buffer;
-    op.params[0].tmpref.size = *size;
-    
-    // Call TA to get the blob
-    TEEC_InvokeCommand(&sess, CMD_GET_LOG, &op, NULL);
-    *size = op.params[0].tmpref.size;
+/* 5. Shadow Stack: Exit, checked before the function returns.
+ * Emitted by the pass for frames that hold stack buffers, where a
+ * corrupted return address must be caught before it is used.
+ */
+void __oat_func_exit_sync(int func_id) {
+    if (!is_initialized) return;
+    oat_push_event(EVT_STACK_POP, func_id, 0);
+    oat_self->n_ret++;
+    oat_flush_events();
 }
 
-
-// Function to retrieve the log blob
-void __oat_export_log(const char* filename) {
+/* Send the calling thread's buffered events now. Worker threads call this
+ * before the operation's proof is taken so their hooks are included. */
+void __oat_thread_flush(void) {
     if (!is_initialized) return;
+    oat_flush_events();
+}
 
-    // Buffer to hold the log (Match TA size)
-    uint8_t buffer[8192];
+/* Fetch one CMD_GET_LOG page of a stream's blob, from `offset`, into
+ * log_page (log_lock held). Sets the page size, the bytes left after it,
+ * the number of events the TA could not record and the operation's
+ * stream count. */
+static TEEC_Result oat_get_log_page(uint32_t op_id, uint32_t stream, uint32_t offset,
+                                    uint32_t *page, uint32_t *remaining, uint32_t *lost,
+                                    uint32_t *streams) {
     TEEC_Operation op = {0};
-    
-    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
-    op.params[0].tmpref.buffer = buffer;
-    op.params[0].tmpref.size = sizeof(buffer);
+    if (log_registered) {
+        op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_OUTPUT, TEEC_VALUE_INOUT, TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT);
+        op.params[0].memref.parent = &log_shm;
+        op.params[0].memref.offset = 0;
+        op.params[0].memref.size = OAT_LOG_PAGE;
+    } else {
+        op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_VALUE_INOUT, TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT);
+        op.params[0].tmpref.buffer = log_page;
+        op.params[0].tmpref.size = OAT_LOG_PAGE;
+    }
+    op.params[1].value.a = offset;
+    op.params[2].value.a = stream;
+    op.params[2].value.b = op_id;
 
-    TEEC_Result res = TEEC_InvokeCommand(&sess, CMD_GET_LOG, &op, NULL);
-    
-    if (res != TEEC_SUCCESS) {
-        printf("[OAT] Failed to export log: 0x%x\n", res);
+    TEEC_Result res = oat_invoke(STAT_GET_LOG, &op, 0);
+    if (res == TEEC_ERROR_ITEM_NOT_FOUND) *streams = 0;
+    if (res != TEEC_SUCCESS) return res;
+
+    *streams = op.params[3].value.a;
+    *page = log_registered ? op.params[0].memref.size : op.params[0].tmpref.size;
+    *remaining = op.params[1].value.a;
+    *lost = op.params[1].value.b;
+    if (*page == 0 && *remaining > 0) return TEEC_ERROR_GENERIC; /* no progress */
+    return TEEC_SUCCESS;
+}
+
+/* Copy the calling thread's measurement blob into `buffer`, page by page.
+ * *size is the buffer's capacity on entry and the blob's full size on
+ * return; a blob larger than the buffer is cut off at the capacity. */
+void __oat_get_execution_log(uint8_t *buffer, uint32_t *size) {
+    if (!is_initialized) {
+        *size = 0;
         return;
     }
+    oat_flush_events();
 
-    // Write to file
-    uint32_t actual_size = op.params[0].tmpref.size;
-    FILE *f = fopen(filename, "wb");
-    if (f) {
-        fwrite(buffer, 1, actual_size, f);
-        fclose(f);
-        printf("[OAT] Mission Log saved to '%s' (%u bytes)\n", filename, actual_size);
-    } else {
-        printf("[OAT] Error opening file for writing.\n");
+    uint32_t op_id = oat_current_op();
+    uint32_t stream = OAT_LOG_THREAD | (oat_self ? oat_self->tid : 0);
+    uint32_t offset = 0;
+    uint32_t page = 0, remaining = 0, lost = 0, streams = 0;
+
+    pthread_mutex_lock(&log_lock);
+    do {
+        TEEC_Result res = oat_get_log_page(op_id, stream, offset, &page, &remaining, &lost, &streams);
+        if (res != TEEC_SUCCESS) {
+            printf("[OAT] Failed to read log: 0x%x\n", res);
+            break;
+        }
+        if (offset < *size)
+            memcpy(buffer + offset, log_page, page < *size - offset ? page : *size - offset);
+        offset += page;
+    } while (remaining > 0);
+    pthread_mutex_unlock(&log_lock);
+
+    *size = offset;
+}
+
+/* Write one stream's measurement blob, one CMD_GET_LOG page at a time,
+ * and return the operation's stream count (0: nothing was written). */
+static uint32_t oat_export_stream(uint32_t op_id, uint32_t stream, const char *filename) {
+    FILE *f = NULL;
+    uint32_t offset = 0;
+    uint32_t page = 0, remaining = 0, lost = 0, streams = 0;
+
+    do {
+        TEEC_Result res = oat_get_log_page(op_id, stream, offset, &page, &remaining, &lost, &streams);
+        if (res == TEEC_ERROR_ITEM_NOT_FOUND && offset == 0) return streams;
+        if (res != TEEC_SUCCESS) {
+            printf("[OAT] Failed to export log: 0x%x at offset %u\n", res, offset);
+            if (f) fclose(f);
+            return streams;
+        }
+
+        if (!f) f = fopen(filename, "wb");
+        if (!f) {
+            printf("[OAT] Error opening file for writing.\n");
+            return streams;
+        }
+        fwrite(log_page, 1, page, f);
+        offset += page;
+    } while (remaining > 0);
+
+    fclose(f);
+    printf("[OAT] Mission Log saved to '%s' (%u bytes)\n", filename, offset);
+    if (lost)
+        printf("[OAT] WARNING: TA trace limit reached, %u events were hashed but not recorded; "
+               "this log cannot be verified.\n", lost);
+    return streams;
+}
+
+/* Write the measurement blobs of an operation to files, one per stream
+ * the TA reports: the thread that started the operation to `filename`,
+ * later ones to "<filename>.t<N>", N in start order. Every stream is part
+ * of the proof, so each is written even with no trace events, and
+ * "<filename>.t<N>" files left by an earlier operation with more streams
+ * are removed.
+ * There is no size cap on the host side; if the TA hit its trace limit
+ * the events it could not record are reported, since such a log cannot
+ * be verified. */
+static void oat_export_op(uint32_t op_id, const char *filename) {
+    char name[4096];
+    pthread_mutex_lock(&log_lock);
+    uint32_t streams = oat_export_stream(op_id, 0, filename);
+    for (uint32_t stream = 1; stream < OAT_MAX_STREAMS; stream++) {
+        snprintf(name, sizeof(name), "%s.t%u", filename, stream);
+        if (stream < streams)
+            oat_export_stream(op_id, stream, name);
+        else
+            remove(name);
     }
+    pthread_mutex_unlock(&log_lock);
 }
 
-/* Helper to Print Proof */
-void __oat_print_proof() {
-    uint8_t hash[32];
-    TEEC_Operation op = {0};
-    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
-    op.params[0].tmpref.buffer = hash;
-    op.params[0].tmpref.size = 32;
-    TEEC_InvokeCommand(&sess, CMD_HASH_FINAL, &op, NULL);
-    printf("[OAT] Final Execution Proof: ");
+/* The calling thread's operation */
+void __oat_export_log(const char* filename) {
+    if (!is_initialized) return;
+    oat_flush_events();
+    oat_export_op(oat_current_op(), filename);
+}
+
+/* Proof line and per-operation counts, kept together on stdout when
+ * another thread prints at the same time */
+static void oat_print_quote(uint32_t op_id, const uint8_t *hash, const struct oat_counts *c) {
+    flockfile(stdout);
+    if (op_id)
+        printf("[OAT] Operation %u Final Execution Proof: ", op_id);
+    else
+        printf("[OAT] Final Execution Proof: ");
     for(int i=0; i<32; i++) printf("%02x", hash[i]);
     printf("\n");
 
     /* Print instrumentation counts for verification against paper Table III */
     printf("[OAT] --- Instrumentation Statistics (per operation) ---\n");
-    printf("[OAT]   B.Cond  (branch logs):    %lu    (paper: 488)\n", oat_count_branch);
-    printf("[OAT]   Ret     (func exits):     %lu    (paper: 1946)\n", oat_count_ret);
-    printf("[OAT]   Icall   (indirect calls): %lu    (paper: 1)\n", oat_count_indirect);
+    printf("[OAT]   B.Cond  (branch logs):    %lu    (paper: 488)\n", c->branch);
+    printf("[OAT]   Ret     (func exits):     %lu    (paper: 1946)\n", c->ret);
+    printf("[OAT]   Icall   (indirect calls): %lu    (paper: 1)\n", c->indirect);
+    if (c->loop)
+        printf("[OAT]   Loop    (compressed exits): %lu\n", c->loop);
+    if (c->path)
+        printf("[OAT]   Path    (acyclic paths):  %lu\n", c->path);
+    printf("[OAT]   Def-Use (CVI defs/uses):  %lu/%lu    (paper: 2)\n", c->def, c->use);
     printf("[OAT] -------------------------------------------------\n");
+    funlockfile(stdout);
+}
+
+/* Helper to Print Proof
+ * Proof of the calling thread's operation. With several threads the TA
+ * combines their measurements (see final_proof() in oat_ta.c); the totals
+ * include the hooks of every thread that has flushed, in any operation. */
+void __oat_print_proof() {
+    uint8_t hash[32];
+    oat_flush_events();
+    TEEC_Operation op = {0};
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = hash;
+    op.params[0].tmpref.size = 32;
+    op.params[1].value.a = oat_current_op();
+    oat_invoke(STAT_HASH_FINAL, &op, 0);
+
+    struct oat_counts counts;
+    oat_snapshot_counts(&counts);
+    oat_print_quote(op.params[1].value.a, hash, &counts);
+}
+
+/* Asynchronous finalization
+ * __oat_finalize_async() ends the calling thread's operation without
+ * waiting for its proof or log. CMD_HASH_SEAL moves the measurement into a
+ * free pooled context of the TA and the thread goes back to operation 0,
+ * so the next __oat_init() can start at once. A background thread then
+ * takes the proof, prints it with the counts as they were at the call,
+ * writes the log to `log_filename` (unless NULL, same files as
+ * __oat_export_log()) and releases the context.
+ *
+ * Returns a handle for __oat_quote_wait(), or -1 if no context was free or
+ * the thread could not be started; the quote has then been printed and
+ * exported synchronously. Quotes finish in the order they were issued and
+ * all are finished before the program exits.
+ */
+#define OAT_QUOTE_RING 8   // > OAT_MAX_OPS - 1, the most that can be pending
+
+struct oat_quote {
+    int handle;
+    uint32_t op_id;         // operation ID the application finalized
+    uint32_t slot;          // pooled context it was sealed into
+    struct oat_counts counts;
+    char *log_filename;
+    uint8_t proof[32];
+    TEEC_Result res;
+};
+
+static struct oat_quote quote_ring[OAT_QUOTE_RING];
+static int quote_issued = 0;    // last handle handed out
+static int quote_done = 0;      // handles up to this one are finished
+static int quote_thread_started = 0;
+static pthread_t quote_thread;
+static pthread_mutex_t quote_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t quote_cond = PTHREAD_COND_INITIALIZER;
+
+/* Runs on the quote thread: only explicit operation IDs, never oat_self */
+static void oat_finish_quote(struct oat_quote *q) {
+    TEEC_Operation op = {0};
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE);
+    op.params[0].tmpref.buffer = q->proof;
+    op.params[0].tmpref.size = sizeof(q->proof);
+    op.params[1].value.a = q->slot;
+    q->res = oat_invoke(STAT_HASH_FINAL, &op, 0);
+    oat_print_quote(q->op_id, q->proof, &q->counts);
+
+    if (q->log_filename) {
+        oat_export_op(q->slot, q->log_filename);
+        free(q->log_filename);
+        q->log_filename = NULL;
+    }
+
+    TEEC_Operation rel = {0};
+    rel.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE, TEEC_NONE, TEEC_NONE);
+    rel.params[0].value.a = q->slot;
+    oat_invoke(STAT_HASH_RELEASE, &rel, 0);
+}
+
+static void *oat_quote_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&quote_lock);
+    for (;;) {
+        while (quote_done == quote_issued) pthread_cond_wait(&quote_cond, &quote_lock);
+        struct oat_quote *q = &quote_ring[(quote_done + 1) % OAT_QUOTE_RING];
+        pthread_mutex_unlock(&quote_lock);
+
+        oat_finish_quote(q);
+
+        pthread_mutex_lock(&quote_lock);
+        quote_done++;
+        pthread_cond_broadcast(&quote_cond);
+    }
+    return NULL;
+}
+
+static void oat_quote_drain(void) {
+    pthread_mutex_lock(&quote_lock);
+    while (quote_done != quote_issued) pthread_cond_wait(&quote_cond, &quote_lock);
+    pthread_mutex_unlock(&quote_lock);
+}
+
+int __oat_finalize_async(const char *log_filename) {
+    if (!is_initialized) oat_lazy_init();
+    struct oat_thread *t = oat_thread();
+    oat_flush_events();
+
+    pthread_mutex_lock(&quote_lock);
+    if (!quote_thread_started)
+        quote_thread_started = (pthread_create(&quote_thread, NULL, oat_quote_worker, NULL) == 0);
+    int started = quote_thread_started;
+    pthread_mutex_unlock(&quote_lock);
+
+    /* A sealed operation takes no more events, so one that other threads
+     * are still on is snapshotted instead: the TA copies it into the
+     * pooled context and it keeps running for them. */
+    int shared = t->op_id < OAT_MAX_OPS &&
+                 __atomic_load_n(&oat_op_users[t->op_id], __ATOMIC_ACQUIRE) > 1;
+
+    TEEC_Operation op = {0};
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT, TEEC_NONE, TEEC_NONE);
+    op.params[0].value.a = t->op_id;
+    op.params[0].value.b = shared ? OAT_SEAL_COPY : 0;
+    if (!started || oat_invoke(STAT_HASH_SEAL, &op, 0) != TEEC_SUCCESS) {
+        __oat_print_proof();
+        if (log_filename) __oat_export_log(log_filename);
+        return -1;
+    }
+
+    // The sealed ID is free again (or, for op 0, stopped until __oat_init);
+    // a snapshotted one is still running and ended as usual
+    uint32_t op_id = t->op_id;
+    oat_set_op(t, 0);
+
+    pthread_mutex_lock(&quote_lock);
+    int handle = ++quote_issued;
+    struct oat_quote *q = &quote_ring[handle % OAT_QUOTE_RING];
+    q->handle = handle;
+    q->op_id = op_id;
+    q->slot = op.params[1].value.a;
+    oat_snapshot_counts(&q->counts);
+    q->log_filename = log_filename ? strdup(log_filename) : NULL;
+    pthread_cond_broadcast(&quote_cond);
+    pthread_mutex_unlock(&quote_lock);
+    return handle;
+}
+
+/* Block until the quote `handle` is finished and copy its proof. Returns
+ * 0, or -1 if the handle is unknown, its proof could not be taken, or it
+ * is so old that its ring entry has been reused. */
+int __oat_quote_wait(int handle, uint8_t proof[32]) {
+    pthread_mutex_lock(&quote_lock);
+    if (handle <= 0 || handle > quote_issued) {
+        pthread_mutex_unlock(&quote_lock);
+        return -1;
+    }
+    while (quote_done < handle) pthread_cond_wait(&quote_cond, &quote_lock);
+
+    struct oat_quote *q = &quote_ring[handle % OAT_QUOTE_RING];
+    int ok = q->handle == handle && q->res == TEEC_SUCCESS;
+    if (ok && proof) memcpy(proof, q->proof, sizeof(q->proof));
+    pthread_mutex_unlock(&quote_lock);
+    return ok ? 0 : -1;
+}
+
+/* Append this operation's per-command TEE latency to a file.
+ * "*.csv" gets one row per command (header written to an empty file),
+ * anything else one JSON object per line. Returns 0 on success.
+ *
+ * Events are batched, so HASH_UPDATE/STACK_* normally stay at zero and
+ * their cost shows up under EVENT_BATCH (see the "events" column).
+ */
+int __oat_export_stats(const char *filename) {
+    size_t len = strlen(filename);
+    int csv = len >= 4 && strcmp(filename + len - 4, ".csv") == 0;
+
+    FILE *f = fopen(filename, "a");
+    if (!f) {
+        printf("[OAT] Error opening stats file '%s'.\n", filename);
+        return -1;
+    }
+
+    pthread_mutex_lock(&tee_lock);
+    if (csv) {
+        if (ftell(f) == 0) {
+            fprintf(f, "op,cmd,calls,events,total_ns,min_ns,max_ns");
+            for (int b = 0; b < OAT_STAT_BUCKETS; b++) fprintf(f, ",hist_2^%d", b);
+            fprintf(f, "\n");
+        }
+        for (int i = 0; i < STAT_COUNT; i++) {
+            struct oat_cmd_stat *st = &cmd_stats[i];
+            fprintf(f, "%lu,%s,%llu,%llu,%llu,%llu,%llu", oat_op_seq, st->name,
+                    (unsigned long long)st->calls, (unsigned long long)st->events,
+                    (unsigned long long)st->total_ns,
+                    (unsigned long long)(st->calls ? st->min_ns : 0),
+                    (unsigned long long)st->max_ns);
+            for (int b = 0; b < OAT_STAT_BUCKETS; b++)
+                fprintf(f, ",%llu", (unsigned long long)st->hist[b]);
+            fprintf(f, "\n");
+        }
+    } else {
+        fprintf(f, "{\"op\":%lu,\"hash\":\"%s\",\"commands\":[", oat_op_seq,
+                hash_alg == OAT_HASH_BLAKE2S ? "blake2s" : "sha256");
+        for (int i = 0; i < STAT_COUNT; i++) {
+            struct oat_cmd_stat *st = &cmd_stats[i];
+            fprintf(f, "%s{\"cmd\":\"%s\",\"id\":%u,\"calls\":%llu,\"events\":%llu,"
+                       "\"total_ns\":%llu,\"min_ns\":%llu,\"max_ns\":%llu,\"hist_log2_ns\":{",
+                    i ? "," : "", st->name, st->cmd,
+                    (unsigned long long)st->calls, (unsigned long long)st->events,
+                    (unsigned long long)st->total_ns,
+                    (unsigned long long)(st->calls ? st->min_ns : 0),
+                    (unsigned long long)st->max_ns);
+            int first = 1;
+            for (int b = 0; b < OAT_STAT_BUCKETS; b++) {
+                if (!st->hist[b]) continue;
+                fprintf(f, "%s\"%d\":%llu", first ? "" : ",", b, (unsigned long long)st->hist[b]);
+                first = 0;
+            }
+            fprintf(f, "}}");
+        }
+        fprintf(f, "]}\n");
+    }
+    pthread_mutex_unlock(&tee_lock);
+
+    fclose(f);
+    return 0;
 }
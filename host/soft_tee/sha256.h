@@ -0,0 +1,24 @@
+/* host/soft_tee/sha256.h */
+#ifndef SOFT_TEE_SHA256_H
+#define SOFT_TEE_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Plain FIPS 180-4 SHA-256 backing TEE_ALG_SHA256 in the software TEE */
+
+#define SHA256_BLOCK_SIZE  64
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t total;
+    uint8_t buf[SHA256_BLOCK_SIZE];
+    uint32_t buflen;
+} sha256_ctx;
+
+void sha256_init(sha256_ctx *c);
+void sha256_update(sha256_ctx *c, const void *data, size_t len);
+void sha256_final(sha256_ctx *c, uint8_t out[SHA256_DIGEST_SIZE]);
+
+#endif /* SOFT_TEE_SHA256_H */
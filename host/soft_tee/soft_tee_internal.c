@@ -0,0 +1,99 @@
+/* host/soft_tee/soft_tee_internal.c
+ * Software TEE: GP Internal Core API subset for running oat_ta.c in the
+ * normal-world process. Heap is libc, digests are sha256.c.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tee_internal_api.h>
+#include "sha256.h"
+
+struct soft_tee_operation {
+    uint32_t algorithm;
+    sha256_ctx sha;
+};
+
+/* --- Memory --- */
+
+void *TEE_Malloc(uint32_t size, uint32_t hint) {
+    (void)hint;  // TEE_MALLOC_FILL_ZERO is the only hint, calloc covers it
+    return calloc(1, size ? size : 1);
+}
+
+void *TEE_Realloc(void *buffer, uint32_t newSize) {
+    return realloc(buffer, newSize);
+}
+
+void TEE_Free(void *buffer) {
+    free(buffer);
+}
+
+void *TEE_MemMove(void *dest, const void *src, uint32_t size) {
+    return memmove(dest, src, size);
+}
+
+void TEE_MemFill(void *buffer, uint32_t x, uint32_t size) {
+    memset(buffer, (int)x, size);
+}
+
+int32_t TEE_MemCompare(const void *buffer1, const void *buffer2, uint32_t size) {
+    return memcmp(buffer1, buffer2, size);
+}
+
+/* --- Digest --- */
+
+TEE_Result TEE_AllocateOperation(TEE_OperationHandle *operation,
+                                 uint32_t algorithm, uint32_t mode,
+                                 uint32_t maxKeySize) {
+    (void)maxKeySize;
+    if (algorithm != TEE_ALG_SHA256 || mode != TEE_MODE_DIGEST)
+        return TEE_ERROR_NOT_SUPPORTED;
+
+    TEE_OperationHandle op = calloc(1, sizeof(*op));
+    if (!op) return TEE_ERROR_OUT_OF_MEMORY;
+    op->algorithm = algorithm;
+    sha256_init(&op->sha);
+    *operation = op;
+    return TEE_SUCCESS;
+}
+
+void TEE_FreeOperation(TEE_OperationHandle operation) {
+    free(operation);
+}
+
+void TEE_ResetOperation(TEE_OperationHandle operation) {
+    sha256_init(&operation->sha);
+}
+
+void TEE_CopyOperation(TEE_OperationHandle dstOperation, TEE_OperationHandle srcOperation) {
+    *dstOperation = *srcOperation;
+}
+
+void TEE_DigestUpdate(TEE_OperationHandle operation,
+                      const void *chunk, uint32_t chunkSize) {
+    if (chunkSize) sha256_update(&operation->sha, chunk, chunkSize);
+}
+
+// As in GP, a finished digest is back in its initial state
+TEE_Result TEE_DigestDoFinal(TEE_OperationHandle operation,
+                             const void *chunk, uint32_t chunkLen,
+                             void *hash, uint32_t *hashLen) {
+    if (*hashLen < SHA256_DIGEST_SIZE) {
+        *hashLen = SHA256_DIGEST_SIZE;
+        return TEE_ERROR_SHORT_BUFFER;
+    }
+    if (chunkLen) sha256_update(&operation->sha, chunk, chunkLen);
+    sha256_final(&operation->sha, hash);
+    sha256_init(&operation->sha);
+    *hashLen = SHA256_DIGEST_SIZE;
+    return TEE_SUCCESS;
+}
+
+/* --- Time --- */
+
+void TEE_GetSystemTime(TEE_Time *time) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    time->seconds = (uint32_t)ts.tv_sec;
+    time->millis = (uint32_t)(ts.tv_nsec / 1000000);
+}
@@ -0,0 +1,182 @@
+/* host/soft_tee/soft_teec.c
+ * Software TEE: GP Client API calls go straight to the TA entry points of
+ * ta/oat/ta/oat_ta.c linked into the same process. liboat.c is compiled
+ * unchanged against these headers, so the backend is chosen at link time
+ * (this file + the TA sources instead of -lteec).
+ *
+ * OAT_SOFT_LATENCY_NS=<ns> busy-waits that long on every open/invoke to
+ * model the SMC round-trip of a real world switch.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tee_client_api.h>
+#include <tee_internal_api.h>
+
+/* A TA instance handles one call at a time, as OP-TEE does */
+static pthread_mutex_t ta_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t latency_ns = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Spin rather than sleep: SMC costs are a few microseconds
+static void inject_latency(void) {
+    if (!latency_ns) return;
+    uint64_t until = now_ns() + latency_ns;
+    while (now_ns() < until) { }
+}
+
+/* --- Parameter marshalling (client view <-> TA view) --- */
+
+static TEEC_Result to_ta_params(TEEC_Operation *op, uint32_t *types, TEE_Param p[4]) {
+    memset(p, 0, sizeof(TEE_Param) * 4);
+    *types = 0;
+    if (!op) return TEEC_SUCCESS;
+
+    for (int i = 0; i < 4; i++) {
+        uint32_t t = TEEC_PARAM_TYPE_GET(op->paramTypes, i);
+        uint32_t ta_type = TEE_PARAM_TYPE_NONE;
+        TEEC_Parameter *q = &op->params[i];
+
+        switch (t) {
+            case TEEC_NONE:
+                break;
+            case TEEC_VALUE_INPUT:
+            case TEEC_VALUE_OUTPUT:
+            case TEEC_VALUE_INOUT:
+                ta_type = t;
+                p[i].value.a = q->value.a;
+                p[i].value.b = q->value.b;
+                break;
+            case TEEC_MEMREF_TEMP_INPUT:
+            case TEEC_MEMREF_TEMP_OUTPUT:
+            case TEEC_MEMREF_TEMP_INOUT:
+                ta_type = t;
+                p[i].memref.buffer = q->tmpref.buffer;
+                p[i].memref.size = q->tmpref.size;
+                break;
+            case TEEC_MEMREF_WHOLE:
+                if (!q->memref.parent) return TEEC_ERROR_BAD_PARAMETERS;
+                if (q->memref.parent->flags == TEEC_MEM_INPUT) ta_type = TEE_PARAM_TYPE_MEMREF_INPUT;
+                else if (q->memref.parent->flags == TEEC_MEM_OUTPUT) ta_type = TEE_PARAM_TYPE_MEMREF_OUTPUT;
+                else ta_type = TEE_PARAM_TYPE_MEMREF_INOUT;
+                p[i].memref.buffer = q->memref.parent->buffer;
+                p[i].memref.size = q->memref.parent->size;
+                break;
+            case TEEC_MEMREF_PARTIAL_INPUT:
+            case TEEC_MEMREF_PARTIAL_OUTPUT:
+            case TEEC_MEMREF_PARTIAL_INOUT:
+                if (!q->memref.parent ||
+                    q->memref.offset + q->memref.size > q->memref.parent->size)
+                    return TEEC_ERROR_BAD_PARAMETERS;
+                ta_type = t - (TEEC_MEMREF_PARTIAL_INPUT - TEE_PARAM_TYPE_MEMREF_INPUT);
+                p[i].memref.buffer = (uint8_t *)q->memref.parent->buffer + q->memref.offset;
+                p[i].memref.size = q->memref.size;
+                break;
+            default:
+                return TEEC_ERROR_BAD_PARAMETERS;
+        }
+        *types |= ta_type << (i * 4);
+    }
+    return TEEC_SUCCESS;
+}
+
+static void from_ta_params(TEEC_Operation *op, TEE_Param p[4]) {
+    if (!op) return;
+
+    for (int i = 0; i < 4; i++) {
+        uint32_t t = TEEC_PARAM_TYPE_GET(op->paramTypes, i);
+        TEEC_Parameter *q = &op->params[i];
+
+        if (t == TEEC_VALUE_OUTPUT || t == TEEC_VALUE_INOUT) {
+            q->value.a = p[i].value.a;
+            q->value.b = p[i].value.b;
+        } else if (t >= TEEC_MEMREF_TEMP_INPUT && t <= TEEC_MEMREF_TEMP_INOUT) {
+            q->tmpref.size = p[i].memref.size;
+        } else if (t >= TEEC_MEMREF_WHOLE) {
+            q->memref.size = p[i].memref.size;
+        }
+    }
+}
+
+/* --- GP Client API --- */
+
+TEEC_Result TEEC_InitializeContext(const char *name, TEEC_Context *context) {
+    (void)name;
+    const char *env = getenv("OAT_SOFT_LATENCY_NS");
+    latency_ns = env ? strtoull(env, NULL, 0) : 0;
+
+    context->initialized = 1;
+    return TA_CreateEntryPoint();
+}
+
+void TEEC_FinalizeContext(TEEC_Context *context) {
+    context->initialized = 0;
+    TA_DestroyEntryPoint();
+}
+
+TEEC_Result TEEC_OpenSession(TEEC_Context *context, TEEC_Session *session,
+                             const TEEC_UUID *destination,
+                             uint32_t connectionMethod,
+                             const void *connectionData,
+                             TEEC_Operation *operation,
+                             uint32_t *returnOrigin) {
+    uint32_t types;
+    TEE_Param p[4];
+    (void)destination; (void)connectionMethod; (void)connectionData;
+
+    if (returnOrigin) *returnOrigin = TEEC_ORIGIN_API;
+    if (!context || !context->initialized) return TEEC_ERROR_BAD_STATE;
+    if (to_ta_params(operation, &types, p) != TEEC_SUCCESS) return TEEC_ERROR_BAD_PARAMETERS;
+
+    session->ctx = context;
+    pthread_mutex_lock(&ta_lock);
+    inject_latency();
+    TEE_Result res = TA_OpenSessionEntryPoint(types, p, &session->ta_sess);
+    pthread_mutex_unlock(&ta_lock);
+
+    from_ta_params(operation, p);
+    if (returnOrigin) *returnOrigin = TEEC_ORIGIN_TRUSTED_APP;
+    return res;
+}
+
+void TEEC_CloseSession(TEEC_Session *session) {
+    pthread_mutex_lock(&ta_lock);
+    TA_CloseSessionEntryPoint(session->ta_sess);
+    pthread_mutex_unlock(&ta_lock);
+}
+
+TEEC_Result TEEC_InvokeCommand(TEEC_Session *session, uint32_t commandID,
+                               TEEC_Operation *operation,
+                               uint32_t *returnOrigin) {
+    uint32_t types;
+    TEE_Param p[4];
+
+    if (returnOrigin) *returnOrigin = TEEC_ORIGIN_API;
+    if (to_ta_params(operation, &types, p) != TEEC_SUCCESS) return TEEC_ERROR_BAD_PARAMETERS;
+
+    pthread_mutex_lock(&ta_lock);
+    inject_latency();
+    TEE_Result res = TA_InvokeCommandEntryPoint(session->ta_sess, commandID, types, p);
+    pthread_mutex_unlock(&ta_lock);
+
+    from_ta_params(operation, p);
+    if (returnOrigin) *returnOrigin = TEEC_ORIGIN_TRUSTED_APP;
+    return res;
+}
+
+// Same address space: registration is bookkeeping only
+TEEC_Result TEEC_RegisterSharedMemory(TEEC_Context *context,
+                                      TEEC_SharedMemory *sharedMem) {
+    if (!context || !sharedMem || !sharedMem->buffer) return TEEC_ERROR_BAD_PARAMETERS;
+    return TEEC_SUCCESS;
+}
+
+void TEEC_ReleaseSharedMemory(TEEC_SharedMemory *sharedMem) {
+    (void)sharedMem;
+}
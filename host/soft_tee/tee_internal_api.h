@@ -0,0 +1,97 @@
+/* host/soft_tee/tee_internal_api.h
+ * Software TEE: the subset of the GP TEE Internal Core API used by
+ * ta/oat/ta, implemented in-process by soft_tee_internal.c.
+ */
+#ifndef SOFT_TEE_INTERNAL_API_H
+#define SOFT_TEE_INTERNAL_API_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef uint32_t TEE_Result;
+
+#define TEE_SUCCESS                 0x00000000
+#define TEE_ERROR_GENERIC           0xFFFF0000
+#define TEE_ERROR_BAD_PARAMETERS    0xFFFF0006
+#define TEE_ERROR_BAD_STATE         0xFFFF0007
+#define TEE_ERROR_ITEM_NOT_FOUND    0xFFFF0008
+#define TEE_ERROR_NOT_SUPPORTED     0xFFFF000A
+#define TEE_ERROR_OUT_OF_MEMORY     0xFFFF000C
+#define TEE_ERROR_SECURITY          0xFFFF000F
+#define TEE_ERROR_SHORT_BUFFER      0xFFFF0010
+#define TEE_ERROR_OVERFLOW          0xFFFF300F
+
+#define TEE_PARAM_TYPE_NONE          0
+#define TEE_PARAM_TYPE_VALUE_INPUT   1
+#define TEE_PARAM_TYPE_VALUE_OUTPUT  2
+#define TEE_PARAM_TYPE_VALUE_INOUT   3
+#define TEE_PARAM_TYPE_MEMREF_INPUT  5
+#define TEE_PARAM_TYPE_MEMREF_OUTPUT 6
+#define TEE_PARAM_TYPE_MEMREF_INOUT  7
+
+#define TEE_PARAM_TYPES(t0, t1, t2, t3) \
+    ((t0) | ((t1) << 4) | ((t2) << 8) | ((t3) << 12))
+#define TEE_PARAM_TYPE_GET(t, i) (((t) >> ((i) * 4)) & 0xF)
+
+typedef union {
+    struct {
+        void *buffer;
+        uint32_t size;
+    } memref;
+    struct {
+        uint32_t a;
+        uint32_t b;
+    } value;
+} TEE_Param;
+
+typedef struct {
+    uint32_t seconds;
+    uint32_t millis;
+} TEE_Time;
+
+typedef struct soft_tee_operation *TEE_OperationHandle;
+#define TEE_HANDLE_NULL ((TEE_OperationHandle)0)
+
+#define TEE_ALG_SHA256   0x50000004
+#define TEE_MODE_DIGEST  3
+
+#define TEE_MALLOC_FILL_ZERO 0x00000000
+
+void *TEE_Malloc(uint32_t size, uint32_t hint);
+void *TEE_Realloc(void *buffer, uint32_t newSize);
+void TEE_Free(void *buffer);
+void *TEE_MemMove(void *dest, const void *src, uint32_t size);
+void TEE_MemFill(void *buffer, uint32_t x, uint32_t size);
+int32_t TEE_MemCompare(const void *buffer1, const void *buffer2, uint32_t size);
+
+TEE_Result TEE_AllocateOperation(TEE_OperationHandle *operation,
+                                 uint32_t algorithm, uint32_t mode,
+                                 uint32_t maxKeySize);
+void TEE_FreeOperation(TEE_OperationHandle operation);
+void TEE_ResetOperation(TEE_OperationHandle operation);
+void TEE_CopyOperation(TEE_OperationHandle dstOperation, TEE_OperationHandle srcOperation);
+void TEE_DigestUpdate(TEE_OperationHandle operation,
+                      const void *chunk, uint32_t chunkSize);
+TEE_Result TEE_DigestDoFinal(TEE_OperationHandle operation,
+                             const void *chunk, uint32_t chunkLen,
+                             void *hash, uint32_t *hashLen);
+
+void TEE_GetSystemTime(TEE_Time *time);
+
+/* OP-TEE trace macros (tee_internal_api_extensions / trace.h) */
+#define EMSG(...) do { fprintf(stderr, "E/TA: " __VA_ARGS__); fputc('\n', stderr); } while (0)
+#define IMSG(...) do { fprintf(stderr, "I/TA: " __VA_ARGS__); fputc('\n', stderr); } while (0)
+#define DMSG(...) do { } while (0)
+
+/* TA entry points, called by soft_teec.c */
+TEE_Result TA_CreateEntryPoint(void);
+void TA_DestroyEntryPoint(void);
+TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types, TEE_Param params[4],
+                                    void **sess_ctx);
+void TA_CloseSessionEntryPoint(void *sess_ctx);
+TEE_Result TA_InvokeCommandEntryPoint(void *sess_ctx, uint32_t cmd_id,
+                                      uint32_t param_types, TEE_Param params[4]);
+
+#endif /* SOFT_TEE_INTERNAL_API_H */
@@ -0,0 +1,9 @@
+/* host/soft_tee/tee_internal_api_extensions.h
+ * Nothing from the OP-TEE extensions is used by the TA; this only
+ * satisfies its #include. */
+#ifndef SOFT_TEE_INTERNAL_API_EXTENSIONS_H
+#define SOFT_TEE_INTERNAL_API_EXTENSIONS_H
+
+#include <tee_internal_api.h>
+
+#endif /* SOFT_TEE_INTERNAL_API_EXTENSIONS_H */
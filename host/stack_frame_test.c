@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+
+// Forward declarations
+void __oat_print_proof();
+
+// Every function below has a stack buffer that an overflow can reach, so
+// the pass must instrument all three returns with __oat_func_exit_sync:
+//   opt ... -passes=oat-pass stack_frame.ll -S | grep -A3 "define.*parse_"
+// The last one keeps the batched __oat_func_exit.
+
+struct packet {
+    char payload[16];   // overflow runs into `len` and then the frame
+    int len;
+};
+
+// Buffer inside a struct: not an array alloca, but its address escapes
+int parse_struct(const char *in) {
+    struct packet p;
+    strcpy(p.payload, in);
+    p.len = (int)strlen(p.payload);
+    return p.len;
+}
+
+// Plain array
+int parse_array(const char *in) {
+    char buf[16];
+    strcpy(buf, in);
+    return (int)strlen(buf);
+}
+
+// VLA, allocated outside the entry block
+int parse_vla(const char *in, int n) {
+    int len = 0;
+    if (n > 0) {
+        char buf[n];
+        strcpy(buf, in);
+        len = (int)strlen(buf);
+    }
+    return len;
+}
+
+// Only scalars, never addressed: safe, its return can be batched
+int checksum(int a, int b) {
+    int s = a ^ b;
+    return s + 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *in = argc > 1 ? argv[1] : "ok";
+
+    printf("--- Stack Frame Test ---\n");
+    // An argument over 15 characters overflows the buffers
+    int total = parse_struct(in) + parse_array(in) + parse_vla(in, 16);
+    printf("total %d\n", checksum(total, 7));
+
+    __oat_print_proof();
+    return 0;
+}
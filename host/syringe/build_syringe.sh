@@ -6,6 +6,8 @@ SYSROOT="/home/rajesh/latest_optee/optee_rpi3/out-br/host/aarch64-buildroot-linu
 OPTEE_CLIENT_PATH="$SYSROOT/usr"
 CROSS_CC="/home/rajesh/latest_optee/optee_rpi3/toolchains/aarch64/bin/aarch64-none-linux-gnu-gcc"
 OAT_PASS="../OATPass.so"
+# Optional pass options, e.g. OAT_PASS_OPTS="loop-compress"
+OAT_PASS_OPTS="${OAT_PASS_OPTS:-}"
 
 # --- BUILD STEPS ---
 
@@ -32,7 +34,7 @@ llvm-link syringePump.ll util.ll LiquidCrystal.ll led.ll -S -o syringe_combined.
 
 # 4. Run OAT Pass on combined IR
 echo "[4/6] Running OAT Pass (instrumentation)..."
-opt -load-pass-plugin=$OAT_PASS -passes=oat-pass \
+opt -load-pass-plugin=$OAT_PASS -passes="oat-pass${OAT_PASS_OPTS:+<$OAT_PASS_OPTS>}" \
     syringe_combined.ll -S -o syringe_instrumented.ll
 
 # 5. Lower to ARM64 object file
@@ -42,7 +44,7 @@ llc -march=aarch64 -filetype=obj syringe_instrumented.ll -o syringe.o
 # 6. Link final binary
 echo "[6/6] Linking final binary..."
 $CROSS_CC --sysroot=$SYSROOT syringe.o liboat.o -o syringe_app \
-    -L$OPTEE_CLIENT_PATH/lib -lteec -lm
+    -L$OPTEE_CLIENT_PATH/lib -lteec -lpthread -lm
 
 echo ""
 echo "=== BUILD COMPLETE ==="
@@ -54,6 +56,7 @@ echo "  B.Cond (conditional branches):  grep -c 'call.*__oat_log' syringe_instru
 echo "  Ret (shadow stack pops):        grep -c 'call.*__oat_func_exit' syringe_instrumented.ll"
 echo "  Icall/Ijmp (indirect calls):    grep -c 'call.*__oat_log_indirect' syringe_instrumented.ll"
 echo "  Func entries (shadow stack):    grep -c 'call.*__oat_func_enter' syringe_instrumented.ll"
+echo "  Def-Use (CVI sites):             grep -c 'call.*__oat_cvi_\(def\|use\)' syringe_instrumented.ll"
 echo ""
 echo "Paper expected: B.Cond=488, Ret=1946, Icall/Ijmp=1, Def-Use=2"
 echo ""
@@ -64,10 +67,16 @@ BCOND=$(grep -c 'call.*__oat_log(' syringe_instrumented.ll || true)
 RET=$(grep -c 'call.*__oat_func_exit' syringe_instrumented.ll || true)
 ICALL=$(grep -c 'call.*__oat_log_indirect' syringe_instrumented.ll || true)
 ENTER=$(grep -c 'call.*__oat_func_enter' syringe_instrumented.ll || true)
+LOOPS=$(grep -c 'call.*__oat_log_loop' syringe_instrumented.ll || true)
+PATHS=$(grep -c 'call.*__oat_log_path' syringe_instrumented.ll || true)
+CVI=$(grep -c 'call.*__oat_cvi_\(def\|use\)' syringe_instrumented.ll || true)
 
 echo "  B.Cond (branch logs):     $BCOND"
 echo "  Ret (func exits):         $RET"
 echo "  Icall/Ijmp (indirect):    $ICALL"
 echo "  Func entries:             $ENTER"
+echo "  Compressed loops:         $LOOPS"
+echo "  Path ends:                $PATHS"
+echo "  Def-Use (CVI sites):      $CVI"
 echo ""
 echo "Copy 'syringe_app' to your Raspberry Pi to run."
@@ -21,6 +21,7 @@
 void __oat_init(void);
 void __oat_print_proof(void);
 void __oat_export_log(const char* filename);
+int __oat_export_stats(const char* filename);
 
 
 /* -- Constants -- */
@@ -145,6 +146,7 @@ void loop(int count){
 
 		__oat_print_proof();
 		__oat_export_log("syringe.bin");
+		__oat_export_stats("syringe_stats.json");
 	}
 
         end = usecs();
@@ -376,6 +378,25 @@ int main(int argc, char **args) {
 	printf("Starting syringe pump\n");
 	setup();
 
+	// BENCH: "syringe_app <script>" runs one operation per line of the
+	// script (the count passed to loop(), '#' starts a comment) instead
+	// of the evaluation sequence below
+	if(argc > 1){
+		FILE *script = fopen(args[1], "r");
+		if(!script){
+			printf("Cannot open script '%s'\n", args[1]);
+			return 1;
+		}
+		char line[64];
+		while(fgets(line, sizeof(line), script)){
+			int count;
+			if(line[0] != '#' && sscanf(line, "%d", &count) == 1)
+				loop(count);
+		}
+		fclose(script);
+		return 0;
+	}
+
 	int count = 1;
 	while(count < 62) {
 		count += 10;
@@ -78,8 +78,12 @@ unsigned long usecs() {
 
 }
 
+// BENCH: built with -DOAT_BENCH_NO_DELAY the motor steps do not sleep,
+// so operation time is the code (and its attestation) alone
 void delayMicroseconds(float usecs) {
+#ifndef OAT_BENCH_NO_DELAY
 	usleep((long)usecs);
+#endif
 }
 
 int toUInt(char* input, int len) {
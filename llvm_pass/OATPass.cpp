@@ -2,18 +2,1235 @@
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
 
 using namespace llvm;
 
 namespace {
 
+// Options given in the pipeline string, e.g. -passes="oat-pass<loop-compress>"
+struct OATOptions {
+  // Replace per-iteration branch events of straight-line counted loops
+  // with one __oat_log_loop(site, trips) event at the loop exit
+  bool LoopCompress = false;
+  // Skip __oat_func_enter/exit in leaves that cannot corrupt their own
+  // return address (see isSafeLeaf), and report what was skipped
+  bool ElideLeaf = false;
+  // Record branch decisions inline in a thread-local word (see
+  // emitInlineLog) instead of calling __oat_log per branch
+  bool InlineLog = false;
+  // Operation entry points (entry=<fn>, or annotate("oat_entry")). When
+  // any are given, only functions reachable from them are instrumented
+  std::vector<std::string> Entries;
+  // With entry points: functions outside the operations keep their
+  // shadow-stack hooks instead of getting none
+  bool ScopeStack = false;
+  // Number each function's acyclic paths (Ball-Larus, see numberPaths)
+  // and log one __oat_log_path(site, path) where a path ends instead of
+  // one event per branch
+  bool PathLog = false;
+  // Precede every hook call with __oat_prof_site(id) and name the sites
+  // in .oat_sites, for the profiling runtime (see emitProfileSites)
+  bool Profile = false;
+  // Place hooks by the IR's profile (branch weights from
+  // -fprofile-instr-use): branches in hot blocks use the inline bit
+  // buffer, and path register updates move to cold edges (see
+  // placePathUpdates). Proofs are the same as without it
+  bool PGO = false;
+};
+
+// A loop whose only conditional branch is its single exit. Every
+// iteration takes the same path, so the trip count is the whole story.
+struct CompressedLoop {
+  Loop *L;
+  BranchInst *ExitBranch;
+  BasicBlock *Preheader;
+  BasicBlock *ExitBlock;
+};
+
+// Ball-Larus numbering of one function. Cutting the back edges (and the
+// call edges of numberPaths) leaves a DAG; each cut edge u->h becomes a
+// path end u->EXIT plus a path start ENTRY->h, and a return a path end.
+// Summing the edge values along any path from ENTRY to EXIT gives a
+// distinct ID in [0, NumPaths[entry]).
+struct PathPlan {
+  struct Edge {
+    BasicBlock *From;
+    BasicBlock *To; // null for a return
+    uint32_t Val;   // Ball-Larus value (a cut edge: to end the path)
+    bool Cut;
+    uint32_t Reset; // cut edge: register value for the path it starts
+    uint32_t Add;   // added to the register on the edge: Val, unless placed
+  };
+  std::vector<Edge> Edges;
+  DenseMap<BasicBlock *, uint64_t> NumPaths;
+  // Path ID so far minus the register, per block: 0 unless placed
+  DenseMap<BasicBlock *, uint32_t> Offset;
+  // Blocks numberPaths split off before a call, and where they came from
+  DenseMap<BasicBlock *, BasicBlock *> SplitFrom;
+};
+
+// Block and edge frequencies of a function (BlockFrequencyInfo scaled by
+// BranchProbabilityInfo), taken before the pass changes its CFG, and
+// the blocks the profile summary counts as hot
+struct ProfileWeights {
+  DenseMap<const BasicBlock *, uint64_t> Block;
+  DenseMap<std::pair<const BasicBlock *, const BasicBlock *>, uint64_t> Edge;
+  SmallPtrSet<const BasicBlock *, 16> Hot;
+};
+
+// One load, store or pointer-taking call on a sensitive variable (CVI)
+struct CVIAccess {
+  Instruction *I;
+  GlobalVariable *Var;
+  Value *Ptr; // pointer operand of a load/store, derived from Var
+};
+
+// TA limits on sensitive variables (must match oat_ta.h): up to 256 of them,
+// sent and hashed as 16-bit IDs, and accesses are keyed by a 16-bit offset
+// into the variable
+static constexpr uint32_t OAT_CVI_MAX_VARS = 256;
+static constexpr uint64_t OAT_CVI_MAX_SIZE = 0xFFFF;
+
+// Index reported for a target outside its call site's table (must match
+// oat_ta.h). Tables are capped below it so an index always fits a byte.
+static constexpr uint32_t OAT_ICALL_UNLISTED = 0xFF;
+
 struct OATPass : public PassInfoMixin<OATPass> {
-  
-  PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM) {
+  OATOptions Opts;
+  uint32_t NextLoopSite = 0;  // module-unique loop site IDs
+  uint32_t NextICallSite = 0; // module-unique indirect call site IDs
+  uint32_t NextPathSite = 0;  // module-unique path-numbered functions
+  std::vector<StringRef> ElidedFuncs;
+  // loop-compress: uninstrumented copies of the invariant functions, and
+  // the ones compressed loops ended up calling
+  DenseMap<Function *, Function *> QuietClones;
+  std::vector<StringRef> SummarizedFuncs;
+  DenseMap<const Function *, uint16_t> FuncIDs;
+  std::vector<Function *> AddrTaken; // possible indirect targets, by name
+  DenseMap<const GlobalVariable *, uint16_t> VarIDs; // CVI variables
+  SmallPtrSet<const Function *, 16> OpBoundary; // can start or end an operation
+  SmallPtrSet<const Function *, 16> PathFuncs;   // path-log candidates
+  SmallPtrSet<const Function *, 16> PathLoggers; // ... and their callers
+  ProfileSummaryInfo *PSI = nullptr;  // with pgo
+  uint32_t HotBranches = 0;           // pgo: logged inline for being hot
+  uint32_t PathUpdates = 0, PathEdges = 0; // pgo: edges that still update
+
+  explicit OATPass(OATOptions Opts = OATOptions()) : Opts(Opts) {}
+
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) {
+    FunctionAnalysisManager &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    bool modified = false;
+    NextLoopSite = 0;
+    NextICallSite = 0;
+    NextPathSite = 0;
+    ElidedFuncs.clear();
+    SummarizedFuncs.clear();
+    HotBranches = PathUpdates = PathEdges = 0;
+    PSI = Opts.PGO ? &MAM.getResult<ProfileSummaryAnalysis>(M) : nullptr;
+
+    // Before any tables exist, which would take addresses themselves
+    AddrTaken.clear();
+    for (Function &F : M)
+      if (F.hasAddressTaken() && !F.isIntrinsic() && !F.getName().startswith("__oat_"))
+        AddrTaken.push_back(&F);
+    std::sort(AddrTaken.begin(), AddrTaken.end(), [](Function *A, Function *B) {
+      return A->getName() < B->getName();
+    });
+
+    // Snapshot first: instrumenting adds __oat_* declarations to M
+    std::vector<Function *> Worklist;
+    for (Function &F : M)
+      if (!F.isDeclaration() && !F.getName().startswith("__oat_"))
+        Worklist.push_back(&F);
+
+    assignFunctionIDs(M, Worklist);
+
+    // Also before instrumenting: offsets add new uses of the variables
+    std::vector<CVIAccess> CVIAccesses = collectSensitiveAccesses(M);
+
+    // And before any hook calls or tables add edges of their own
+    SmallPtrSet<Function *, 32> InScope;
+    bool Scoped = findOperationScope(M, InScope);
+    PathFuncs.clear();
+    if (Opts.PathLog) {
+      SmallPtrSet<Function *, 32> Full;
+      for (Function *F : Worklist)
+        if (!Scoped || InScope.count(F)) Full.insert(F);
+      findPathFunctions(Worklist, Full);
+    }
+
+    // From the pristine bodies, before any hooks are added to them
+    QuietClones.clear();
+    if (Opts.LoopCompress) createQuietClones(Worklist, CVIAccesses);
+
+    uint32_t StackOnly = 0;
+    for (Function *F : Worklist) {
+      bool Full = !Scoped || InScope.count(F);
+      if (!Full && !Opts.ScopeStack) continue;
+      if (!Full) StackOnly++;
+      modified |= instrumentFunction(*F, FAM, !Full);
+    }
+    if (Scoped) {
+      errs() << "[OAT] " << M.getModuleIdentifier() << ": " << InScope.size() << " of "
+             << Worklist.size() << " functions reachable from the operation entry points";
+      if (Opts.ScopeStack) errs() << ", " << StackOnly << " more with shadow stack only";
+      errs() << "\n";
+    }
+
+    // After the per-function hooks, so leaf elision is decided without them.
+    // Not scoped: a store outside the operations still has to be attested,
+    // or the next use inside one would look like tampering.
+    modified |= instrumentSensitiveAccesses(M, CVIAccesses);
+
+    if (Opts.PathLog)
+      errs() << "[OAT] " << M.getModuleIdentifier() << ": paths numbered in "
+             << NextPathSite << " of " << Worklist.size() << " functions\n";
+
+    if (Opts.PGO) {
+      errs() << "[OAT] " << M.getModuleIdentifier() << ": profile-guided: ";
+      if (PSI->hasProfileSummary())
+        errs() << HotBranches << " hot branches logged inline";
+      else
+        errs() << "no profile summary, no branches counted as hot";
+      if (Opts.PathLog)
+        errs() << ", path register updated on " << PathUpdates << " of " << PathEdges
+               << " edges";
+      errs() << "\n";
+    }
+
+    // Last, so every hook the pass added gets a site
+    if (Opts.Profile) {
+      uint32_t Sites = emitProfileSites(M, Worklist);
+      errs() << "[OAT] " << M.getModuleIdentifier() << ": " << Sites
+             << " profiling sites\n";
+      modified |= Sites != 0;
+    }
+
+    if (Opts.LoopCompress) {
+      eraseUnusedClones(Worklist);
+      errs() << "[OAT] " << M.getModuleIdentifier() << ": " << NextLoopSite
+             << " loops compressed, " << SummarizedFuncs.size()
+             << " functions summarized in their bodies\n";
+      for (StringRef Name : SummarizedFuncs)
+        errs() << "[OAT]   summarized: " << Name << "\n";
+    }
+
+    if (Opts.ElideLeaf) {
+      errs() << "[OAT] " << M.getModuleIdentifier() << ": shadow stack elided in "
+             << ElidedFuncs.size() << " of " << Worklist.size() << " functions\n";
+      for (StringRef Name : ElidedFuncs)
+        errs() << "[OAT]   elided: " << Name << "\n";
+    }
+
+    return modified ? PreservedAnalyses::none() : PreservedAnalyses::all();
+  }
+
+  // Dense IDs 1..N in name order: collision-free, and stable across
+  // rebuilds as long as the set of functions does not change. 0 is never
+  // assigned. Run on the llvm-linked program, the IDs are program-wide.
+  void assignFunctionIDs(Module &M, std::vector<Function *> &Funcs) {
+    std::sort(Funcs.begin(), Funcs.end(), [](Function *A, Function *B) {
+      return A->getName() < B->getName();
+    });
+    if (Funcs.size() > UINT16_MAX)
+      report_fatal_error("oat-pass: more than 65535 functions, IDs are 16-bit");
+
+    FuncIDs.clear();
+    uint16_t next = 1;
+    for (Function *F : Funcs) FuncIDs[F] = next++;
+
+    emitFunctionTable(M, Funcs);
+  }
+
+  // ID-to-name table in section .oat_funcs so traces and shadow-stack
+  // reports can be decoded from the binary:
+  //   "OATF" | uint16 count | { uint16 id, uint16 len, char name[len] }*
+  // Little-endian, no padding.
+  void emitFunctionTable(Module &M, const std::vector<Function *> &Funcs) {
+    std::vector<std::pair<uint16_t, StringRef>> Entries;
+    for (Function *F : Funcs) Entries.push_back({FuncIDs[F], F->getName()});
+    emitNameTable(M, "OATF", ".oat_funcs", "__oat_func_table", Entries);
+  }
+
+  static GlobalVariable *emitNameTable(Module &M, StringRef Magic, StringRef Section,
+                                       StringRef Name,
+                                       const std::vector<std::pair<uint16_t, StringRef>> &Entries) {
+    std::string blob = Magic.str();
+    auto put16 = [&blob](uint16_t v) {
+      blob.push_back((char)(v & 0xFF));
+      blob.push_back((char)(v >> 8));
+    };
+
+    put16((uint16_t)Entries.size());
+    for (auto &E : Entries) {
+      StringRef name = E.second.take_front(UINT16_MAX);
+      put16(E.first);
+      put16((uint16_t)name.size());
+      blob.append(name.begin(), name.end());
+    }
+
+    Constant *Init = ConstantDataArray::getString(M.getContext(), blob, false);
+    auto *GV = new GlobalVariable(M, Init->getType(), true,
+                                  GlobalValue::InternalLinkage, Init, Name);
+    GV->setSection(Section);
+    GV->setAlignment(Align(1));
+    appendToUsed(M, {GV});
+    return GV;
+  }
+
+  // Hook calls the pass emits, by the kind the site table names them
+  static StringRef hookKind(StringRef Callee) {
+    return StringSwitch<StringRef>(Callee)
+        .Case("__oat_log", "branch")
+        .Case("__oat_log_indirect", "icall")
+        .Case("__oat_log_indirect_idx", "icall_idx")
+        .Case("__oat_log_loop", "loop")
+        .Case("__oat_log_path", "path")
+        .Case("__oat_func_enter", "enter")
+        .Case("__oat_func_exit", "exit")
+        .Case("__oat_func_exit_sync", "exit")
+        .Case("__oat_cvi_def", "cvi_def")
+        .Case("__oat_cvi_use", "cvi_use")
+        .Case("__oat_cvi_forget", "cvi_forget")
+        .Case("__oat_bits_flush", "bits")
+        .Default("");
+  }
+
+  // Number every hook call 1..N (function name order, then program order)
+  // and put __oat_prof_site(id) right before it, so the runtime knows
+  // which site each event comes from without any hook changing its
+  // signature. Site names "function:kind[:line]" go into .oat_sites
+  // ("OATS", same layout as .oat_funcs) under the external symbol
+  // __oat_site_table, which liboat.c looks up. Inline-logged branches
+  // make no calls and are only seen through their "bits" flushes.
+  uint32_t emitProfileSites(Module &M, const std::vector<Function *> &Funcs) {
+    LLVMContext &Ctx = M.getContext();
+    FunctionCallee siteFunc = M.getOrInsertFunction(
+        "__oat_prof_site", Type::getVoidTy(Ctx), Type::getInt32Ty(Ctx));
+
+    std::vector<std::string> Names;
+    std::vector<std::pair<CallBase *, uint32_t>> Calls;
+    for (Function *F : Funcs) {
+      for (Instruction &I : instructions(F)) {
+        auto *CB = dyn_cast<CallBase>(&I);
+        Function *Callee = CB ? CB->getCalledFunction() : nullptr;
+        StringRef Kind = Callee ? hookKind(Callee->getName()) : "";
+        if (Kind.empty()) continue;
+
+        std::string Name = (F->getName() + ":" + Kind).str();
+        if (const DebugLoc &DL = CB->getDebugLoc())
+          Name += ":" + std::to_string(DL.getLine());
+        Names.push_back(std::move(Name));
+        Calls.push_back({CB, (uint32_t)Names.size()});
+      }
+    }
+    if (Names.size() > UINT16_MAX)
+      report_fatal_error("oat-pass: more than 65535 profiling sites, IDs are 16-bit");
+
+    for (auto &C : Calls) {
+      IRBuilder<> Builder(C.first);
+      Builder.CreateCall(siteFunc, {Builder.getInt32(C.second)});
+    }
+
+    std::vector<std::pair<uint16_t, StringRef>> Entries;
+    for (size_t i = 0; i < Names.size(); i++) Entries.push_back({(uint16_t)(i + 1), Names[i]});
+    if (!Entries.empty())
+      emitNameTable(M, "OATS", ".oat_sites", "__oat_site_table", Entries)
+          ->setLinkage(GlobalValue::ExternalLinkage);
+    return Calls.size();
+  }
+
+  // Globals marked __attribute__((annotate(Tag))), in name order
+  template <typename T>
+  static std::vector<T *> findAnnotated(Module &M, StringRef Tag) {
+    std::vector<T *> Found;
+    GlobalVariable *Annos = M.getNamedGlobal("llvm.global.annotations");
+    if (!Annos || !Annos->hasInitializer()) return Found;
+    auto *Arr = dyn_cast<ConstantArray>(Annos->getInitializer());
+    if (!Arr) return Found;
+
+    // { i8* annotated, i8* annotation, i8* file, i32 line, ... }
+    for (const Use &U : Arr->operands()) {
+      auto *Entry = dyn_cast<ConstantStruct>(U.get());
+      if (!Entry || Entry->getNumOperands() < 2) continue;
+      auto *GV = dyn_cast<T>(Entry->getOperand(0)->stripPointerCasts());
+      auto *Str = dyn_cast<GlobalVariable>(Entry->getOperand(1)->stripPointerCasts());
+      if (!GV || !Str || !Str->hasInitializer()) continue;
+      auto *Data = dyn_cast<ConstantDataSequential>(Str->getInitializer());
+      if (!Data || !Data->isCString() || Data->getAsCString() != Tag) continue;
+      if (std::find(Found.begin(), Found.end(), GV) == Found.end()) Found.push_back(GV);
+    }
+
+    std::sort(Found.begin(), Found.end(), [](T *A, T *B) {
+      return A->getName() < B->getName();
+    });
+    return Found;
+  }
+
+  static std::vector<GlobalVariable *> findSensitiveVars(Module &M) {
+    return findAnnotated<GlobalVariable>(M, "sensitive");
+  }
+
+  // Functions an operation can run: everything reachable from the entry
+  // points through direct calls, indirect calls (any compatible
+  // address-taken function, as for the target tables) and function
+  // addresses the reachable code hands on, e.g. callbacks to a library.
+  // Returns false when no entry points are given: the whole module is in
+  // scope, as before.
+  bool findOperationScope(Module &M, SmallPtrSetImpl<Function *> &Scope) {
+    std::vector<Function *> Work = findAnnotated<Function>(M, "oat_entry");
+    for (const std::string &Name : Opts.Entries) {
+      Function *F = M.getFunction(Name);
+      if (!F || F->isDeclaration())
+        report_fatal_error("oat-pass: entry point '" + Twine(Name) + "' is not defined in " +
+                           M.getModuleIdentifier());
+      Work.push_back(F);
+    }
+    if (Work.empty()) return false;
+
+    auto visit = [&](Function *F) {
+      if (!F->isDeclaration() && !F->getName().startswith("__oat_") && Scope.insert(F).second)
+        Work.push_back(F);
+    };
+    std::vector<Function *> Entries;
+    Entries.swap(Work);
+    for (Function *F : Entries) visit(F);
+
+    while (!Work.empty()) {
+      Function *F = Work.back();
+      Work.pop_back();
+      for (Instruction &I : instructions(*F)) {
+        auto *CB = dyn_cast<CallBase>(&I);
+        if (CB && CB->isIndirectCall()) {
+          for (Function *T : AddrTaken)
+            if (isCompatibleTarget(*CB, *T)) visit(T);
+        }
+        for (Value *Op : I.operands()) {
+          auto *C = dyn_cast<Constant>(Op);
+          if (!C) continue;
+          if (auto *T = dyn_cast<Function>(C->stripPointerCasts())) visit(T);
+        }
+      }
+    }
+    return true;
+  }
+
+  // Constants that only end up in llvm.* globals (the annotation itself,
+  // llvm.used) do not expose the variable
+  static bool feedsOnlyMetadata(Constant *C) {
+    for (User *U : C->users()) {
+      if (auto *GV = dyn_cast<GlobalVariable>(U)) {
+        if (!GV->getName().startswith("llvm.")) return false;
+      } else if (auto *CU = dyn_cast<Constant>(U)) {
+        if (!feedsOnlyMetadata(CU)) return false;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Loads and stores through pointers derived from Var (GEPs and casts,
+  // instructions or constants) and calls that receive one. False if the
+  // address escapes any other way: writes through an escaped copy would
+  // not be attested, so every later load would look like an attack.
+  static bool collectAccesses(GlobalVariable *Var, std::vector<CVIAccess> &Out) {
+    SmallVector<Value *, 16> Work = {Var};
+    SmallPtrSet<Value *, 16> Seen;
+    SmallPtrSet<Instruction *, 8> Calls;
+
+    while (!Work.empty()) {
+      Value *P = Work.pop_back_val();
+      if (!Seen.insert(P).second) continue;
+
+      for (User *U : P->users()) {
+        if (isa<GEPOperator>(U) || isa<BitCastOperator>(U)) {
+          Work.push_back(U);
+        } else if (auto *LI = dyn_cast<LoadInst>(U)) {
+          Out.push_back({LI, Var, P});
+        } else if (auto *SI = dyn_cast<StoreInst>(U)) {
+          if (SI->getValueOperand() == P) return false;
+          Out.push_back({SI, Var, P});
+        } else if (auto *CI = dyn_cast<CallInst>(U)) {
+          if (auto *II = dyn_cast<IntrinsicInst>(CI))
+            if (isa<DbgInfoIntrinsic>(II) || II->isLifetimeStartOrEnd()) continue;
+          if (CI->getCalledOperand() == P) return false;
+          if (Calls.insert(CI).second) Out.push_back({CI, Var, nullptr});
+        } else if (isa<ICmpInst>(U)) {
+          continue;
+        } else if (auto *GV = dyn_cast<GlobalVariable>(U)) {
+          if (!GV->getName().startswith("llvm.")) return false;
+        } else if (auto *C = dyn_cast<Constant>(U)) {
+          if (!feedsOnlyMetadata(C)) return false;
+        } else {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Assigns CVI variable IDs 0..N-1 in name order, emits the ID-to-name
+  // table into .oat_cvi ("OATV", same layout as .oat_funcs) and returns
+  // the accesses to instrument. Untrackable variables are reported.
+  std::vector<CVIAccess> collectSensitiveAccesses(Module &M) {
+    std::vector<CVIAccess> Accesses;
+    std::vector<std::pair<uint16_t, StringRef>> Entries;
+    const DataLayout &DL = M.getDataLayout();
+    VarIDs.clear();
+
+    for (GlobalVariable *Var : findSensitiveVars(M)) {
+      std::vector<CVIAccess> VarAccesses;
+      const char *Skip = nullptr;
+      if (Entries.size() >= OAT_CVI_MAX_VARS)
+        Skip = "too many sensitive variables";
+      else if (DL.getTypeAllocSize(Var->getValueType()) > OAT_CVI_MAX_SIZE)
+        Skip = "larger than 64 KB";
+      else if (!collectAccesses(Var, VarAccesses))
+        Skip = "address escapes";
+      if (Skip) {
+        errs() << "[OAT] cvi: " << Var->getName() << " not tracked (" << Skip << ")\n";
+        continue;
+      }
+
+      uint16_t ID = Entries.size();
+      VarIDs[Var] = ID;
+      Entries.push_back({ID, Var->getName()});
+      Accesses.insert(Accesses.end(), VarAccesses.begin(), VarAccesses.end());
+    }
+
+    if (!Entries.empty()) emitNameTable(M, "OATV", ".oat_cvi", "__oat_cvi_table", Entries);
+    return Accesses;
+  }
+
+  // The 32 bits the TA keeps per access: the value itself, or the xor of
+  // its halves for 64-bit values. Null for anything wider or non-scalar.
+  static Value *foldValue(IRBuilder<> &B, Value *V) {
+    Type *T = V->getType();
+    const DataLayout &DL = B.GetInsertBlock()->getModule()->getDataLayout();
+    if (T->isPointerTy())
+      V = B.CreatePtrToInt(V, DL.getIntPtrType(T));
+    else if (T->isFloatingPointTy())
+      V = B.CreateBitCast(V, B.getIntNTy(T->getPrimitiveSizeInBits()));
+    else if (!T->isIntegerTy())
+      return nullptr;
+
+    unsigned Bits = V->getType()->getIntegerBitWidth();
+    if (Bits <= 32) return B.CreateZExt(V, B.getInt32Ty());
+    if (Bits > 64) return nullptr;
+    Value *Lo = B.CreateTrunc(V, B.getInt32Ty());
+    Value *Hi = B.CreateTrunc(B.CreateLShr(V, 32), B.getInt32Ty());
+    return B.CreateXor(Lo, Hi);
+  }
+
+  // CVI: every store reports the value it writes (def) and every load the
+  // value it got (use), keyed by variable and byte offset. The TA flags a
+  // use that differs from the last def. A call handed a pointer into the
+  // variable may write it unseen, so the TA forgets the variable after it.
+  bool instrumentSensitiveAccesses(Module &M, const std::vector<CVIAccess> &Accesses) {
+    if (Accesses.empty()) return false;
+    LLVMContext &Ctx = M.getContext();
+    Type *I32 = Type::getInt32Ty(Ctx);
+
+    // void __oat_cvi_def(int var, int offset, int value)
+    FunctionCallee defFunc = M.getOrInsertFunction(
+        "__oat_cvi_def", Type::getVoidTy(Ctx), I32, I32, I32);
+    // void __oat_cvi_use(int var, int offset, int value)
+    FunctionCallee useFunc = M.getOrInsertFunction(
+        "__oat_cvi_use", Type::getVoidTy(Ctx), I32, I32, I32);
+    // void __oat_cvi_forget(int var)
+    FunctionCallee forgetFunc = M.getOrInsertFunction(
+        "__oat_cvi_forget", Type::getVoidTy(Ctx), I32);
+
+    for (const CVIAccess &A : Accesses) {
+      Value *varID = ConstantInt::get(I32, VarIDs.lookup(A.Var));
+
+      if (isa<CallInst>(A.I)) {
+        IRBuilder<> After(A.I->getNextNode());
+        After.CreateCall(forgetFunc, {varID});
+        continue;
+      }
+
+      // Def before the store, use after the load
+      bool isStore = isa<StoreInst>(A.I);
+      IRBuilder<> Builder(isStore ? A.I : A.I->getNextNode());
+      Value *val = foldValue(Builder, isStore ? cast<StoreInst>(A.I)->getValueOperand() : A.I);
+      if (!val) {
+        // Cannot be checked; a store of it must still drop the old value
+        if (isStore) Builder.CreateCall(forgetFunc, {varID});
+        continue;
+      }
+
+      // Constant for scalars and fixed indices, computed for the rest
+      const DataLayout &DL = M.getDataLayout();
+      APInt constOff(DL.getIndexTypeSizeInBits(A.Ptr->getType()), 0);
+      Value *off;
+      if (A.Ptr->stripAndAccumulateConstantOffsets(DL, constOff, true) == A.Var) {
+        off = Builder.getInt32((uint32_t)constOff.getZExtValue());
+      } else {
+        Type *IntPtr = DL.getIntPtrType(A.Ptr->getType());
+        off = Builder.CreateSub(Builder.CreatePtrToInt(A.Ptr, IntPtr),
+                                Builder.CreatePtrToInt(A.Var, IntPtr));
+        off = Builder.CreateTrunc(off, I32);
+      }
+      Builder.CreateCall(isStore ? defFunc : useFunc, {varID, off, val});
+    }
+    return true;
+  }
+
+  // Pointer types are interchangeable here: with typed pointers the same
+  // object is often passed as i8* on one side and as a struct* on the other
+  static bool compatibleType(Type *A, Type *B) {
+    return A == B || (A->isPointerTy() && B->isPointerTy());
+  }
+
+  // Could this call reach F? Return type and the arguments actually passed
+  // must line up with F's signature. Unprototyped C (`void (*fp)()`) calls
+  // through a varargs type, so the call's own type is not compared.
+  static bool isCompatibleTarget(CallBase &CB, Function &F) {
+    FunctionType *FT = F.getFunctionType();
+    if (!compatibleType(CB.getType(), FT->getReturnType())) return false;
+    if (FT->isVarArg() ? CB.arg_size() < FT->getNumParams()
+                       : CB.arg_size() != FT->getNumParams())
+      return false;
+    for (unsigned I = 0; I < FT->getNumParams(); I++)
+      if (!compatibleType(CB.getArgOperand(I)->getType(), FT->getParamType(I)))
+        return false;
+    return true;
+  }
+
+  // Target table for one indirect call site, emitted into .oat_icall as
+  // __oat_icall_table.<site> so the verifier can map indices back to
+  // functions. Empty when the site has to fall back to raw addresses
+  // (no candidates, or too many for a one-byte index).
+  std::vector<Function *> buildTargetTable(CallBase &CB, uint32_t &Site) {
+    std::vector<Function *> Table;
+    for (Function *F : AddrTaken)
+      if (isCompatibleTarget(CB, *F)) Table.push_back(F);
+    if (Table.empty() || Table.size() >= OAT_ICALL_UNLISTED) return {};
+
+    Module &M = *CB.getModule();
+    Type *PtrTy = Type::getInt8PtrTy(M.getContext());
+    std::vector<Constant *> Elems;
+    for (Function *F : Table)
+      Elems.push_back(ConstantExpr::getBitCast(F, PtrTy));
+
+    Site = NextICallSite++;
+    auto *ArrTy = ArrayType::get(PtrTy, Elems.size());
+    auto *GV = new GlobalVariable(M, ArrTy, true, GlobalValue::InternalLinkage,
+                                  ConstantArray::get(ArrTy, Elems),
+                                  "__oat_icall_table." + Twine(Site));
+    GV->setSection(".oat_icall");
+    appendToUsed(M, {GV});
+    return Table;
+  }
+
+  // A leaf that cannot corrupt its own return address: no calls (so no
+  // inline asm and no memcpy-style intrinsics), no indirectbr, and every
+  // alloca is only loaded from or stored to directly. Nothing in the frame
+  // can be written through a computed pointer, so the return is safe
+  // without a shadow-stack check.
+  static bool isSafeLeaf(Function &F) { return hasSafeFrame(F, false); }
+
+  // isSafeLeaf's frame check. With DirectCalls, plain calls to a named
+  // function are allowed too (still no inline asm or indirect calls), and
+  // it is up to the caller to vet the callees.
+  static bool hasSafeFrame(Function &F, bool DirectCalls) {
+    for (BasicBlock &BB : F) {
+      if (isa<IndirectBrInst>(BB.getTerminator())) return false;
+
+      for (Instruction &I : BB) {
+        if (auto *CB = dyn_cast<CallBase>(&I)) {
+          auto *II = dyn_cast<IntrinsicInst>(CB);
+          bool Allowed = II ? isa<DbgInfoIntrinsic>(II) || II->isLifetimeStartOrEnd()
+                            : DirectCalls && isa<CallInst>(CB) && CB->getCalledFunction();
+          if (!Allowed) return false;
+        }
+
+        if (auto *AI = dyn_cast<AllocaInst>(&I)) {
+          for (User *U : AI->users()) {
+            if (isa<LoadInst>(U)) continue;
+            if (auto *SI = dyn_cast<StoreInst>(U))
+              if (SI->getPointerOperand() == AI && SI->getValueOperand() != AI)
+                continue;
+            if (auto *II = dyn_cast<IntrinsicInst>(U))
+              if (isa<DbgInfoIntrinsic>(II) || II->isLifetimeStartOrEnd())
+                continue;
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // One path through the body (unconditional branches and returns only)
+  // in a safe frame, and no sensitive variable accesses, which the copy
+  // would leave unattested. Its hooks log the same events every time it
+  // runs, as long as its callees do too.
+  static bool isInvariantFunction(Function &F,
+                                  const SmallPtrSetImpl<const Instruction *> &Sensitive) {
+    for (BasicBlock &BB : F) {
+      Instruction *T = BB.getTerminator();
+      if (auto *BI = dyn_cast<BranchInst>(T)) {
+        if (BI->isConditional()) return false;
+      } else if (!isa<ReturnInst>(T) && !isa<UnreachableInst>(T)) {
+        return false;
+      }
+      for (Instruction &I : BB)
+        if (Sensitive.count(&I)) return false;
+    }
+    return hasSafeFrame(F, true);
+  }
+
+  // Uninstrumented copies ("<name>.oat.quiet") of the invariant functions
+  // whose calls all stay invariant: into other such functions, intrinsics,
+  // or the library when it cannot call back into the program. A compressed
+  // loop calls these instead (see summarizeLoopBody): its body is one path
+  // too, so every iteration would log the same events and the trip count
+  // stands for all of them. The verifier replays the body against the
+  // module it is given, where the copies have no hooks either.
+  void createQuietClones(const std::vector<Function *> &Funcs,
+                         const std::vector<CVIAccess> &CVIAccesses) {
+    SmallPtrSet<const Instruction *, 32> Sensitive;
+    for (const CVIAccess &A : CVIAccesses) Sensitive.insert(A.I);
+    SmallPtrSet<const Function *, 32> Defined(Funcs.begin(), Funcs.end());
+
+    SmallPtrSet<Function *, 16> Invariant;
+    for (Function *F : Funcs)
+      if (isInvariantFunction(*F, Sensitive)) Invariant.insert(F);
+
+    bool Changed = true;
+    while (Changed) {
+      Changed = false;
+      for (Function *F : Funcs) {
+        if (!Invariant.count(F)) continue;
+        for (Instruction &I : instructions(*F)) {
+          auto *CB = dyn_cast<CallBase>(&I);
+          if (!CB || isa<IntrinsicInst>(CB)) continue;
+          Function *Callee = CB->getCalledFunction();
+          bool Quiet = Callee->isDeclaration()
+                           ? !Callee->getName().startswith("__oat_") &&
+                                 !mayCall(*CB, Defined, true)
+                           : Invariant.count(Callee) != 0;
+          if (!Quiet) {
+            Invariant.erase(F);
+            Changed = true;
+            break;
+          }
+        }
+      }
+    }
+
+    for (Function *F : Funcs) {
+      if (!Invariant.count(F)) continue;
+      ValueToValueMapTy VMap;
+      Function *Q = CloneFunction(F, VMap);
+      Q->setName(F->getName() + ".oat.quiet");
+      Q->setLinkage(GlobalValue::InternalLinkage);
+      QuietClones[F] = Q;
+    }
+    for (Function *F : Funcs)
+      if (Function *Q = QuietClones.lookup(F))
+        for (BasicBlock &BB : *Q) redirectToClones(BB, nullptr);
+  }
+
+  // Points the direct calls in BB at the quiet copies, noting the callees
+  void redirectToClones(BasicBlock &BB, SmallVectorImpl<Function *> *Redirected) {
+    for (Instruction &I : BB)
+      if (auto *CB = dyn_cast<CallBase>(&I))
+        if (Function *Callee = CB->getCalledFunction())
+          if (Function *Q = QuietClones.lookup(Callee)) {
+            CB->setCalledFunction(Q);
+            if (Redirected) Redirected->push_back(Callee);
+          }
+  }
+
+  // A compressed loop's calls go to the quiet copies, so an iteration that
+  // only calls invariant functions logs nothing at all
+  void summarizeLoopBody(Loop *L) {
+    SmallVector<Function *, 4> Redirected;
+    for (BasicBlock *BB : L->blocks()) redirectToClones(*BB, &Redirected);
+    for (Function *Callee : Redirected)
+      if (std::find(SummarizedFuncs.begin(), SummarizedFuncs.end(), Callee->getName()) ==
+          SummarizedFuncs.end())
+        SummarizedFuncs.push_back(Callee->getName());
+  }
+
+  // Copies no compressed loop ended up calling, directly or through another
+  void eraseUnusedClones(const std::vector<Function *> &Funcs) {
+    bool Changed = true;
+    while (Changed) {
+      Changed = false;
+      for (Function *F : Funcs) {
+        Function *Q = QuietClones.lookup(F);
+        if (!Q || !Q->use_empty()) continue;
+        Q->eraseFromParent();
+        QuietClones.erase(F);
+        Changed = true;
+      }
+    }
+  }
+
+  // Innermost loop, single exiting block ending in the loop's only
+  // conditional branch, and a dedicated exit block for the summary event.
+  static bool findCompressibleLoop(Loop *L, CompressedLoop &CL) {
+    if (!L->isInnermost()) return false;
+
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Exiting = L->getExitingBlock();
+    BasicBlock *Exit = L->getExitBlock();
+    if (!Preheader || !Exiting || !Exit) return false;
+    if (Exit->getSinglePredecessor() != Exiting) return false;
+
+    auto *ExitBI = dyn_cast<BranchInst>(Exiting->getTerminator());
+    if (!ExitBI || !ExitBI->isConditional()) return false;
+
+    for (BasicBlock *BB : L->blocks()) {
+      if (BB == Exiting) continue;
+      auto *BI = dyn_cast<BranchInst>(BB->getTerminator());
+      if (!BI || BI->isConditional()) return false;
+    }
+
+    CL = {L, ExitBI, Preheader, Exit};
+    return true;
+  }
+
+  // Can this call reach a function in Set? Directly, or through an
+  // indirect call with a compatible address-taken target. With Callbacks,
+  // a call into a declaration counts too when an address-taken function
+  // is in Set, as the library may call it back (qsort and the like).
+  bool mayCall(CallBase &CB, const SmallPtrSetImpl<const Function *> &Set, bool Callbacks) {
+    Function *Callee = CB.getCalledFunction();
+    if (Callee && !Callee->isDeclaration()) return Set.count(Callee);
+    if (Callee && (Callee->isIntrinsic() || Callee->getName().startswith("__oat_")))
+      return false;
+    for (Function *T : AddrTaken)
+      if (Set.count(T) && (Callee ? Callbacks : isCompatibleTarget(CB, *T))) return true;
+    return false;
+  }
+
+  // Grows Set to everything that can call into it (see mayCall)
+  void addCallers(const std::vector<Function *> &Funcs, SmallPtrSetImpl<const Function *> &Set,
+                  bool Callbacks) {
+    bool Changed = true;
+    while (Changed) {
+      Changed = false;
+      for (Function *F : Funcs) {
+        if (Set.count(F)) continue;
+        for (Instruction &I : instructions(*F)) {
+          auto *CB = dyn_cast<CallBase>(&I);
+          if (CB && mayCall(*CB, Set, Callbacks)) {
+            Set.insert(F);
+            Changed = true;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  // Functions that call the runtime themselves (__oat_init, __oat_op_*,
+  // __oat_print_proof, ...) and everything that can call them. A path
+  // still open when an operation starts or ends would be attested only in
+  // part, so these keep logging each branch under path-log.
+  void findOperationBoundary(const std::vector<Function *> &Funcs) {
+    OpBoundary.clear();
+    for (Function *F : Funcs)
+      for (Instruction &I : instructions(*F))
+        if (auto *CB = dyn_cast<CallBase>(&I))
+          if (Function *Callee = CB->getCalledFunction())
+            if (Callee->getName().startswith("__oat_")) OpBoundary.insert(F);
+    addCallers(Funcs, OpBoundary, false);
+  }
+
+  // Worth numbering: at least two branches or switches, and only edges
+  // that can be instrumented (no exception handling or indirectbr)
+  static bool isPathCandidate(Function &F) {
+    unsigned Decisions = 0;
+    for (BasicBlock &BB : F) {
+      Instruction *T = BB.getTerminator();
+      if (BB.isEHPad() || !(isa<BranchInst>(T) || isa<SwitchInst>(T) ||
+                            isa<ReturnInst>(T) || isa<UnreachableInst>(T)))
+        return false;
+      auto *BI = dyn_cast<BranchInst>(T);
+      if (isa<SwitchInst>(T) || (BI && BI->isConditional())) Decisions++;
+    }
+    return Decisions >= 2;
+  }
+
+  // Path-log candidates among the fully instrumented functions, and every
+  // function that may therefore emit path events (see numberPaths)
+  void findPathFunctions(const std::vector<Function *> &Funcs,
+                         const SmallPtrSetImpl<Function *> &Full) {
+    findOperationBoundary(Funcs);
+    PathFuncs.clear();
+    for (Function *F : Funcs)
+      if (Full.count(F) && !OpBoundary.count(F) && isPathCandidate(*F)) PathFuncs.insert(F);
+    PathLoggers.clear();
+    PathLoggers.insert(PathFuncs.begin(), PathFuncs.end());
+    addCallers(Funcs, PathLoggers, true);
+  }
+
+  // Ball-Larus numbering (see PathPlan). Paths also end before every call
+  // that may log paths itself, so S_path lists them in the order they were
+  // walked and the verifier can read each path off the next record rather
+  // than search for it; the block is split there and the split edge cut
+  // like a back edge. False when there are more paths than a 32-bit ID
+  // holds: the function then logs per branch as usual.
+  bool numberPaths(Function &F, PathPlan &Plan) {
+    DenseSet<std::pair<BasicBlock *, BasicBlock *>> Cut;
+    std::vector<CallBase *> Calls;
+    for (Instruction &I : instructions(F))
+      if (auto *CB = dyn_cast<CallBase>(&I))
+        if (mayCall(*CB, PathLoggers, true)) Calls.push_back(CB);
+    for (CallBase *CB : Calls) {
+      BasicBlock *Before = CB->getParent();
+      BasicBlock *After = SplitBlock(Before, CB);
+      Cut.insert({Before, After});
+      Plan.SplitFrom[After] = Before;
+    }
+
+    // Distinct successors: switch cases sharing a block are one edge
+    DenseMap<BasicBlock *, SmallVector<BasicBlock *, 4>> Succs;
+    for (BasicBlock &BB : F)
+      for (BasicBlock *S : successors(&BB))
+        if (!is_contained(Succs[&BB], S)) Succs[&BB].push_back(S);
+
+    // Depth-first from the entry: an edge to a block still on the stack
+    // is a back edge, and postorder visits every DAG successor first
+    std::vector<BasicBlock *> Post, Starts;
+    DenseMap<BasicBlock *, bool> OnStack; // absent: not visited yet
+    std::vector<std::pair<BasicBlock *, unsigned>> Stack;
+    BasicBlock *Entry = &F.getEntryBlock();
+    Stack.push_back({Entry, 0});
+    OnStack[Entry] = true;
+    while (!Stack.empty()) {
+      BasicBlock *BB = Stack.back().first;
+      unsigned I = Stack.back().second++;
+      if (I == Succs[BB].size()) {
+        OnStack[BB] = false;
+        Post.push_back(BB);
+        Stack.pop_back();
+        continue;
+      }
+      BasicBlock *S = Succs[BB][I];
+      auto It = OnStack.find(S);
+      if (It == OnStack.end()) {
+        OnStack[S] = true;
+        Stack.push_back({S, 0});
+      } else if (It->second) {
+        Cut.insert({BB, S});
+      }
+    }
+    for (BasicBlock *BB : Post)
+      for (BasicBlock *S : Succs[BB])
+        if (Cut.count({BB, S}) && !is_contained(Starts, S)) Starts.push_back(S);
+
+    DenseMap<BasicBlock *, uint32_t> Reset; // ENTRY->start dummy edge values
+    for (BasicBlock *BB : Post) {
+      uint64_t N = 0;
+      for (BasicBlock *S : Succs[BB]) {
+        bool IsCut = Cut.count({BB, S});
+        Plan.Edges.push_back({BB, S, (uint32_t)N, IsCut, 0, (uint32_t)N});
+        N += IsCut ? 1 : Plan.NumPaths[S];
+        if (N > UINT32_MAX) return false;
+      }
+      if (Succs[BB].empty()) {
+        if (isa<ReturnInst>(BB->getTerminator())) Plan.Edges.push_back({BB, nullptr, 0, false, 0, 0});
+        N = 1;
+      }
+      if (BB == Entry) {
+        for (BasicBlock *S : Starts) {
+          Reset[S] = (uint32_t)N;
+          N += Plan.NumPaths[S];
+          if (N > UINT32_MAX) return false;
+        }
+      }
+      Plan.NumPaths[BB] = N;
+    }
+
+    for (PathPlan::Edge &E : Plan.Edges) {
+      if (E.Cut) E.Reset = Reset[E.To];
+      E.Add = E.Val;
+    }
+    return true;
+  }
+
+  // Frequencies for placePathUpdates and the hot blocks, while the CFG is
+  // still the one the analyses and the profile describe
+  ProfileWeights profileWeights(Function &F, FunctionAnalysisManager &FAM) {
+    ProfileWeights W;
+    BlockFrequencyInfo &BFI = FAM.getResult<BlockFrequencyAnalysis>(F);
+    BranchProbabilityInfo &BPI = FAM.getResult<BranchProbabilityAnalysis>(F);
+    bool Summary = PSI && PSI->hasProfileSummary();
+    for (BasicBlock &BB : F) {
+      uint64_t Freq = BFI.getBlockFreq(&BB).getFrequency();
+      W.Block[&BB] = Freq;
+      for (BasicBlock *S : successors(&BB))
+        W.Edge[{&BB, S}] = BPI.getEdgeProbability(&BB, S).scale(Freq);
+      if (Summary && PSI->isHotBlock(&BB, &BFI)) W.Hot.insert(&BB);
+    }
+    return W;
+  }
+
+  // Ball-Larus event placement. The numbered graph, with returns and cut
+  // edges ending at a virtual EXIT, cut edges also starting at ENTRY, and
+  // an EXIT->ENTRY edge, gets a maximum spanning tree by frequency. With
+  // Off[v] = (path ID so far) - (register) at block v, each tree edge
+  // u->v fixes Off[v] = Off[u] + Val, and every edge then adds
+  // Off[u] + Val - Off[v]: nothing on the tree, so hot edges and the
+  // back edges of hot loops mostly carry no update. EXIT->ENTRY is forced
+  // into the tree, so the register starts at 0 and holds the full ID
+  // wherever a path ends: the IDs, and the proof, do not change. The
+  // branches' !oat.path values absorb Off so the verifier can steer.
+  void placePathUpdates(Function &F, PathPlan &Plan, const ProfileWeights &W) {
+    DenseMap<BasicBlock *, unsigned> Node;
+    std::vector<BasicBlock *> Blocks;
+    for (BasicBlock &BB : F)
+      if (Plan.NumPaths.count(&BB)) {
+        Node[&BB] = Blocks.size();
+        Blocks.push_back(&BB);
+      }
+    unsigned Entry = Node.lookup(&F.getEntryBlock()), Exit = Blocks.size();
+
+    // Split-off blocks inherit the frequencies of the block they came from
+    auto origin = [&](BasicBlock *BB) {
+      while (BasicBlock *From = Plan.SplitFrom.lookup(BB)) BB = From;
+      return BB;
+    };
+    auto weight = [&](BasicBlock *From, BasicBlock *To) {
+      auto It = To ? W.Edge.find({origin(From), To}) : W.Edge.end();
+      return It != W.Edge.end() ? It->second : W.Block.lookup(origin(From));
+    };
+
+    // From, To, Val, frequency; an end edge per plan edge that has one,
+    // one start edge per path start
+    struct GraphEdge {
+      unsigned From, To;
+      uint32_t Val;
+      uint64_t Freq;
+    };
+    std::vector<GraphEdge> Graph = {{Exit, Entry, 0, UINT64_MAX}};
+    std::vector<unsigned> EdgeOf(Plan.Edges.size());
+    DenseMap<BasicBlock *, unsigned> StartOf;
+    for (size_t I = 0; I < Plan.Edges.size(); I++) {
+      const PathPlan::Edge &E = Plan.Edges[I];
+      uint64_t Freq = weight(E.From, E.To);
+      EdgeOf[I] = Graph.size();
+      Graph.push_back({Node[E.From], E.To && !E.Cut ? Node[E.To] : Exit, E.Val, Freq});
+      if (!E.Cut) continue;
+      auto Ins = StartOf.insert({E.To, Graph.size()});
+      if (Ins.second)
+        Graph.push_back({Entry, Node[E.To], E.Reset, 0});
+      GraphEdge &Start = Graph[Ins.first->second];
+      Start.Freq = SaturatingAdd(Start.Freq, Freq);
+    }
+
+    // Kruskal, hottest first; ties keep the order above so the placement
+    // is the same from build to build
+    std::vector<unsigned> Order(Graph.size()), Parent(Exit + 1);
+    for (unsigned I = 0; I < Order.size(); I++) Order[I] = I;
+    for (unsigned I = 0; I <= Exit; I++) Parent[I] = I;
+    std::stable_sort(Order.begin(), Order.end(), [&](unsigned A, unsigned B) {
+      return Graph[A].Freq > Graph[B].Freq;
+    });
+    auto find = [&](unsigned X) {
+      while (Parent[X] != X) X = Parent[X] = Parent[Parent[X]];
+      return X;
+    };
+    std::vector<SmallVector<std::pair<unsigned, uint32_t>, 4>> Tree(Exit + 1);
+    for (unsigned I : Order) {
+      const GraphEdge &G = Graph[I];
+      unsigned A = find(G.From), B = find(G.To);
+      if (A == B) continue;
+      Parent[A] = B;
+      Tree[G.From].push_back({G.To, G.Val});
+      Tree[G.To].push_back({G.From, -G.Val});
+    }
+
+    std::vector<uint32_t> Off(Exit + 1, 0);
+    std::vector<bool> Seen(Exit + 1, false);
+    std::vector<unsigned> Work = {Entry};
+    Seen[Entry] = true;
+    while (!Work.empty()) {
+      unsigned N = Work.back();
+      Work.pop_back();
+      for (auto &T : Tree[N]) {
+        if (Seen[T.first]) continue;
+        Seen[T.first] = true;
+        Off[T.first] = Off[N] + T.second;
+        Work.push_back(T.first);
+      }
+    }
+
+    auto inc = [&](unsigned G) {
+      return Off[Graph[G].From] + Graph[G].Val - Off[Graph[G].To];
+    };
+
+    // Ball-Larus values are already 0 on many edges. Keep them unless the
+    // tree runs fewer updates by the same frequencies.
+    uint64_t Before = 0, After = 0;
+    for (size_t I = 0; I < Plan.Edges.size(); I++) {
+      uint64_t Freq = Graph[EdgeOf[I]].Freq;
+      if (Plan.Edges[I].Val) Before = SaturatingAdd(Before, Freq);
+      if (inc(EdgeOf[I])) After = SaturatingAdd(After, Freq);
+    }
+    bool Place = After < Before;
+    for (size_t I = 0; I < Plan.Edges.size(); I++) {
+      PathPlan::Edge &E = Plan.Edges[I];
+      if (Place) {
+        E.Add = inc(EdgeOf[I]);
+        if (E.Cut) E.Reset = inc(StartOf[E.To]);
+      }
+      PathEdges++;
+      PathUpdates += E.Add != 0;
+    }
+    if (Place)
+      for (BasicBlock *BB : Blocks) Plan.Offset[BB] = Off[Node[BB]];
+  }
+
+  // The path ID lives in a stack slot: 0 at entry, each edge adds its
+  // value, and a path end reports it and (cut edge) starts the next
+  // path. The slot stores carry !oat.path.add / !oat.path.set with their
+  // constant, and each replaced branch carries !oat.path: the site, then
+  // (value, paths) per successor, so the verifier can steer by S_path.
+  // The values are relative to the register (Val + Offset, mod 2^32).
+  void emitPathLog(Function &F, const PathPlan &Plan, uint32_t Site) {
+    Module &M = *F.getParent();
+    LLVMContext &Ctx = F.getContext();
+    Type *I32 = Type::getInt32Ty(Ctx);
+    // void __oat_log_path(int site, int path)
+    FunctionCallee logPathFunc = M.getOrInsertFunction(
+        "__oat_log_path", Type::getVoidTy(Ctx), I32, I32);
+    auto md = [&](uint32_t V) {
+      return MDNode::get(Ctx, ConstantAsMetadata::get(ConstantInt::get(I32, V)));
+    };
+
+    // Before any edge is split, while successors are the original blocks
+    for (BasicBlock &BB : F) {
+      Instruction *T = BB.getTerminator();
+      auto *BI = dyn_cast<BranchInst>(T);
+      if (!isa<SwitchInst>(T) && !(BI && BI->isConditional())) continue;
+      if (!Plan.NumPaths.count(&BB)) continue; // unreachable
+      SmallVector<Metadata *, 8> Ops = {ConstantAsMetadata::get(ConstantInt::get(I32, Site))};
+      for (BasicBlock *S : successors(&BB)) {
+        for (const PathPlan::Edge &E : Plan.Edges) {
+          if (E.From != &BB || E.To != S) continue;
+          uint64_t Span = E.Cut ? 1 : Plan.NumPaths.lookup(S);
+          uint32_t Val = E.Val + Plan.Offset.lookup(&BB);
+          Ops.push_back(ConstantAsMetadata::get(ConstantInt::get(I32, Val)));
+          Ops.push_back(ConstantAsMetadata::get(ConstantInt::get(I32, (uint32_t)Span)));
+          break;
+        }
+      }
+      T->setMetadata("oat.path", MDNode::get(Ctx, Ops));
+    }
+
+    BasicBlock &EntryBB = F.getEntryBlock();
+    IRBuilder<> BuilderEntry(&*EntryBB.getFirstInsertionPt());
+    AllocaInst *pathVar = BuilderEntry.CreateAlloca(I32, nullptr, "oat.path");
+    BuilderEntry.CreateStore(BuilderEntry.getInt32(0), pathVar)->setMetadata("oat.path.set", md(0));
+
+    for (const PathPlan::Edge &E : Plan.Edges) {
+      if (E.Add == 0 && !E.Cut && E.To) continue;
+
+      // On the edge: at the end of From if it is From's only successor,
+      // at the start of To if From is To's only predecessor, else in a
+      // block of its own
+      Instruction *IP;
+      if (!E.To || E.From->getUniqueSuccessor() == E.To) {
+        IP = E.From->getTerminator();
+      } else if (E.To->getUniquePredecessor() == E.From) {
+        IP = &*E.To->getFirstInsertionPt();
+      } else {
+        Instruction *T = E.From->getTerminator();
+        unsigned SuccNum = GetSuccessorNumber(E.From, E.To);
+        BasicBlock *Mid = SplitCriticalEdge(
+            T, SuccNum, CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+        if (!Mid) report_fatal_error("oat-pass: cannot split a numbered edge in " + F.getName());
+        IP = Mid->getTerminator();
+      }
+
+      IRBuilder<> Builder(IP);
+      if (E.Add) {
+        Value *cur = Builder.CreateLoad(I32, pathVar);
+        Builder.CreateStore(Builder.CreateAdd(cur, Builder.getInt32(E.Add)), pathVar)
+            ->setMetadata("oat.path.add", md(E.Add));
+      }
+      if (E.Cut || !E.To) {
+        Builder.CreateCall(logPathFunc, {Builder.getInt32(Site), Builder.CreateLoad(I32, pathVar)});
+      }
+      if (E.Cut) {
+        Builder.CreateStore(Builder.getInt32(E.Reset), pathVar)
+            ->setMetadata("oat.path.set", md(E.Reset));
+      }
+    }
+  }
+
+  // Inline __oat_log(val) against the runtime's per-thread bit buffer:
+  //   __oat_bits_word |= val << __oat_bits_count;
+  //   if (++__oat_bits_count == 64) __oat_bits_flush();
+  // The runtime drains pending bits before any other event, so the TA sees
+  // the same sequence as with calls. The count store carries !oat.bit with
+  // the decision and the flush branch !oat.flush, for the verifier.
+  void emitInlineLog(BasicBlock *BB, uint32_t val) {
+    Module &M = *BB->getModule();
+    LLVMContext &Ctx = M.getContext();
+    Type *I64 = Type::getInt64Ty(Ctx), *I32 = Type::getInt32Ty(Ctx);
+    auto tls = [&M](StringRef Name, Type *Ty) {
+      auto *GV = cast<GlobalVariable>(M.getOrInsertGlobal(Name, Ty));
+      GV->setThreadLocalMode(GlobalValue::InitialExecTLSModel);
+      return GV;
+    };
+    GlobalVariable *Word = tls("__oat_bits_word", I64);
+    GlobalVariable *Count = tls("__oat_bits_count", I32);
+    FunctionCallee flushFunc = M.getOrInsertFunction("__oat_bits_flush", Type::getVoidTy(Ctx));
+
+    Instruction *IP = &*BB->getFirstInsertionPt();
+    IRBuilder<> Builder(IP);
+    Value *n = Builder.CreateLoad(I32, Count, "oat.n");
+    if (val) {
+      Value *w = Builder.CreateLoad(I64, Word, "oat.w");
+      Value *bit = Builder.CreateShl(ConstantInt::get(I64, 1), Builder.CreateZExt(n, I64));
+      Builder.CreateStore(Builder.CreateOr(w, bit), Word);
+    }
+    Value *next = Builder.CreateAdd(n, ConstantInt::get(I32, 1));
+    Builder.CreateStore(next, Count)->setMetadata(
+        "oat.bit", MDNode::get(Ctx, ConstantAsMetadata::get(Builder.getInt32(val))));
+
+    Value *full = Builder.CreateICmpEQ(next, ConstantInt::get(I32, 64));
+    Instruction *ThenTerm = SplitBlockAndInsertIfThen(full, IP, false);
+    IRBuilder<>(ThenTerm).CreateCall(flushFunc);
+    BB->getTerminator()->setMetadata("oat.flush", MDNode::get(Ctx, {}));
+  }
+
+  // StackOnly: shadow-stack hooks only, for code outside the operations
+  bool instrumentFunction(Function &F, FunctionAnalysisManager &FAM, bool StackOnly) {
     LLVMContext &Ctx = F.getContext();
     bool modified = false;
 
@@ -34,36 +1251,131 @@ struct OATPass : public PassInfoMixin<OATPass> {
     FunctionCallee exitFunc = F.getParent()->getOrInsertFunction(
         "__oat_func_exit", Type::getVoidTy(Ctx), Type::getInt32Ty(Ctx));
 
+    // void __oat_log_indirect_idx(int site, int idx)
+    FunctionCallee logIndirectIdxFunc = F.getParent()->getOrInsertFunction(
+        "__oat_log_indirect_idx", Type::getVoidTy(Ctx), Type::getInt32Ty(Ctx),
+        Type::getInt32Ty(Ctx));
+
+    // void __oat_log_loop(int site, int trips)
+    FunctionCallee logLoopFunc = F.getParent()->getOrInsertFunction(
+        "__oat_log_loop", Type::getVoidTy(Ctx), Type::getInt32Ty(Ctx),
+        Type::getInt32Ty(Ctx));
+
+    // Same as exit, but the runtime waits for the TA verdict before returning
+    FunctionCallee exitSyncFunc = F.getParent()->getOrInsertFunction(
+        "__oat_func_exit_sync", Type::getVoidTy(Ctx), Type::getInt32Ty(Ctx));
+
+    // Returns are batched by the runtime. A frame is only left to that when
+    // nothing in it can be written through a computed pointer (the
+    // hasSafeFrame test elide-leaf uses, callees allowed); any other frame,
+    // e.g. one with a buffer inside a struct or a VLA or dynamic alloca in
+    // any block, may have its return address smashed, so its returns are
+    // checked synchronously before the address is used.
+    bool syncExit = !hasSafeFrame(F, true);
+
+    // Decide before any hook calls are added to the body
+    bool elideStack = Opts.ElideLeaf && isSafeLeaf(F);
+    ProfileWeights weights;
+    if (Opts.PGO && !StackOnly) weights = profileWeights(F, FAM);
+    if (elideStack) ElidedFuncs.push_back(F.getName());
+
     // --- 2. Instrument Entry (Shadow Stack Push) ---
-    uint32_t funcID = 0;
-    StringRef name = F.getName();
-    for(char c : name) funcID += c; // Simple ID generation
+    uint32_t funcID = FuncIDs.lookup(&F);
 
     BasicBlock &EntryBB = F.getEntryBlock();
-    IRBuilder<> BuilderEntry(&*EntryBB.getFirstInsertionPt());
-    BuilderEntry.CreateCall(enterFunc, {BuilderEntry.getInt32(funcID)});
-    modified = true;
+    if (!elideStack) {
+      IRBuilder<> BuilderEntry(&*EntryBB.getFirstInsertionPt());
+      BuilderEntry.CreateCall(enterFunc, {BuilderEntry.getInt32(funcID)});
+      modified = true;
+    }
+
+    // --- 3. Path Numbering or Loop Trip-Count Compression ---
+    // A numbered function reports whole paths, so none of its branches
+    // are logged and its loops are not compressed
+    PathPlan plan;
+    bool numbered = !StackOnly && PathFuncs.count(&F) && numberPaths(F, plan);
+    if (numbered) {
+      if (Opts.PGO) placePathUpdates(F, plan, weights);
+      emitPathLog(F, plan, NextPathSite++);
+      modified = true;
+    }
+
+    // The exiting block runs once per iteration plus once for the exit,
+    // so trips = (times it ran) - 1. Its branch is not logged per
+    // iteration; the exit block reports the trip count instead.
+    SmallPtrSet<BranchInst *, 8> compressedBranches;
+    if (Opts.LoopCompress && !StackOnly && !numbered) {
+      LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+      std::vector<CompressedLoop> loops;
+      for (Loop *L : LI.getLoopsInPreorder()) {
+        CompressedLoop CL;
+        if (findCompressibleLoop(L, CL)) loops.push_back(CL);
+      }
+
+      for (CompressedLoop &CL : loops) {
+        uint32_t site = NextLoopSite++;
+        BasicBlock *Exiting = CL.ExitBranch->getParent();
+
+        IRBuilder<> BuilderAlloca(&*EntryBB.getFirstInsertionPt());
+        AllocaInst *tripVar =
+            BuilderAlloca.CreateAlloca(BuilderAlloca.getInt32Ty(), nullptr, "oat.trips");
+
+        IRBuilder<> BuilderPre(CL.Preheader->getTerminator());
+        BuilderPre.CreateStore(BuilderPre.getInt32(0), tripVar);
 
-    // --- 3. Scan Body for Returns and Indirect Calls ---
+        IRBuilder<> BuilderCount(&*Exiting->getFirstInsertionPt());
+        Value *cur = BuilderCount.CreateLoad(BuilderCount.getInt32Ty(), tripVar);
+        BuilderCount.CreateStore(BuilderCount.CreateAdd(cur, BuilderCount.getInt32(1)), tripVar);
+
+        IRBuilder<> BuilderExitLoop(&*CL.ExitBlock->getFirstInsertionPt());
+        Value *runs = BuilderExitLoop.CreateLoad(BuilderExitLoop.getInt32Ty(), tripVar);
+        Value *trips = BuilderExitLoop.CreateSub(runs, BuilderExitLoop.getInt32(1));
+        BuilderExitLoop.CreateCall(logLoopFunc, {BuilderExitLoop.getInt32(site), trips});
+
+        // Lets an offline verifier find the compressed branch
+        CL.ExitBranch->setMetadata("oat.loop",
+            MDNode::get(Ctx, ConstantAsMetadata::get(BuilderExitLoop.getInt32(site))));
+        compressedBranches.insert(CL.ExitBranch);
+        summarizeLoopBody(CL.L);
+        modified = true;
+      }
+    }
+
+    // --- 4. Scan Body for Returns and Indirect Calls ---
+    // Inline logs split blocks, so they are emitted after the scan
+    std::vector<std::pair<BasicBlock *, uint32_t>> inlineLogs;
     for (auto &BB : F) {
       
       // A. Shadow Stack Pop (Before Returns)
-      if (ReturnInst *RI = dyn_cast<ReturnInst>(BB.getTerminator())) {
+      ReturnInst *RI = dyn_cast<ReturnInst>(BB.getTerminator());
+      if (RI && !elideStack) {
         IRBuilder<> BuilderExit(RI); 
-        BuilderExit.CreateCall(exitFunc, {BuilderExit.getInt32(funcID)});
+        BuilderExit.CreateCall(syncExit ? exitSyncFunc : exitFunc,
+                               {BuilderExit.getInt32(funcID)});
+        modified = true;
       }
+      if (StackOnly) continue;
       
       // B. Branch Logging (Forward Edge)
       Instruction *Term = BB.getTerminator();
       if (BranchInst *BI = dyn_cast<BranchInst>(Term)) {
-        if (BI->isConditional()) {
+        if (BI->isConditional() && !compressedBranches.count(BI) && !numbered) {
           BasicBlock *TrueDest = BI->getSuccessor(0);
-          IRBuilder<> BuilderTrue(&*TrueDest->getFirstInsertionPt());
-          BuilderTrue.CreateCall(logFunc, {BuilderTrue.getInt32(1)});
-
           BasicBlock *FalseDest = BI->getSuccessor(1);
-          IRBuilder<> BuilderFalse(&*FalseDest->getFirstInsertionPt());
-          BuilderFalse.CreateCall(logFunc, {BuilderFalse.getInt32(0)});
+          // pgo: hot blocks use the bit buffer, cold ones keep the call
+          bool hot = weights.Hot.count(&BB);
+          HotBranches += hot && !Opts.InlineLog;
+          if (Opts.InlineLog || hot) {
+            inlineLogs.push_back({TrueDest, 1});
+            inlineLogs.push_back({FalseDest, 0});
+          } else {
+            IRBuilder<> BuilderTrue(&*TrueDest->getFirstInsertionPt());
+            BuilderTrue.CreateCall(logFunc, {BuilderTrue.getInt32(1)});
+
+            IRBuilder<> BuilderFalse(&*FalseDest->getFirstInsertionPt());
+            BuilderFalse.CreateCall(logFunc, {BuilderFalse.getInt32(0)});
+          }
+          modified = true;
         }
       }
 
@@ -79,6 +1391,24 @@ struct OATPass : public PassInfoMixin<OATPass> {
                 
                 // Cast pointer to Int64
                 Value *targetInt = Builder.CreatePtrToInt(targetPtr, Builder.getInt64Ty());
+
+                // Report the target's position in this site's table: one
+                // byte in the hash, independent of where the binary is loaded
+                uint32_t site = 0;
+                std::vector<Function *> table = buildTargetTable(*CI, site);
+                if (!table.empty()) {
+                    Value *idx = Builder.getInt32(OAT_ICALL_UNLISTED);
+                    for (size_t i = table.size(); i-- > 0;) {
+                        Value *entry = Builder.CreatePtrToInt(table[i], Builder.getInt64Ty());
+                        idx = Builder.CreateSelect(Builder.CreateICmpEQ(targetInt, entry),
+                                                   Builder.getInt32(i), idx);
+                    }
+                    Builder.CreateCall(logIndirectIdxFunc, {Builder.getInt32(site), idx});
+                    CI->setMetadata("oat.icall",
+                        MDNode::get(Ctx, ConstantAsMetadata::get(Builder.getInt32(site))));
+                    modified = true;
+                    continue;
+                }
                 
                 // Inject __oat_log_indirect(target_addr) BEFORE the call
                 Builder.CreateCall(logIndirectFunc, {targetInt});
@@ -88,22 +1418,58 @@ struct OATPass : public PassInfoMixin<OATPass> {
       }
     }
 
-    return modified ? PreservedAnalyses::none() : PreservedAnalyses::all();
+    for (auto &L : inlineLogs) emitInlineLog(L.first, L.second);
+
+    return modified;
   }
 };
 
+// "oat-pass" or "oat-pass<opt;opt...>"
+static bool parseOATPassName(StringRef Name, OATOptions &Opts) {
+  if (!Name.consume_front("oat-pass")) return false;
+  if (Name.empty()) return true;
+  if (!Name.consume_front("<") || !Name.consume_back(">")) return false;
+
+  SmallVector<StringRef, 4> Params;
+  Name.split(Params, ';', -1, false);
+  for (StringRef P : Params) {
+    if (P == "loop-compress") {
+      Opts.LoopCompress = true;
+    } else if (P == "elide-leaf") {
+      Opts.ElideLeaf = true;
+    } else if (P == "inline-log") {
+      Opts.InlineLog = true;
+    } else if (P.consume_front("entry=") && !P.empty()) {
+      Opts.Entries.push_back(P.str());
+    } else if (P == "scope-stack") {
+      Opts.ScopeStack = true;
+    } else if (P == "path-log") {
+      Opts.PathLog = true;
+    } else if (P == "profile") {
+      Opts.Profile = true;
+    } else if (P == "pgo") {
+      Opts.PGO = true;
+    } else {
+      errs() << "oat-pass: unknown option '" << P << "'\n";
+      return false;
+    }
+  }
+  return true;
+}
+
 } // namespace
 
 extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
 llvmGetPassPluginInfo() {
   return {
-    LLVM_PLUGIN_API_VERSION, "OATPass", "v0.3",
+    LLVM_PLUGIN_API_VERSION, "OATPass", "v0.12",
     [](PassBuilder &PB) {
       PB.registerPipelineParsingCallback(
-        [](StringRef Name, FunctionPassManager &FPM,
+        [](StringRef Name, ModulePassManager &MPM,
            ArrayRef<PassBuilder::PipelineElement>) {
-          if (Name == "oat-pass") {
-            FPM.addPass(OATPass());
+          OATOptions Opts;
+          if (parseOATPassName(Name, Opts)) {
+            MPM.addPass(OATPass(Opts));
             return true;
           }
           return false;
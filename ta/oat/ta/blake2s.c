@@ -0,0 +1,118 @@
+/* ta/oat/ta/blake2s.c */
+#include <string.h>
+#include <blake2s.h>
+
+static const uint32_t blake2s_iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint8_t blake2s_sigma[10][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+};
+
+static inline uint32_t rotr32(uint32_t x, unsigned n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t load32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#define G(a, b, c, d, x, y)              \
+    do {                                 \
+        a = a + b + (x);                 \
+        d = rotr32(d ^ a, 16);           \
+        c = c + d;                       \
+        b = rotr32(b ^ c, 12);           \
+        a = a + b + (y);                 \
+        d = rotr32(d ^ a, 8);            \
+        c = c + d;                       \
+        b = rotr32(b ^ c, 7);            \
+    } while (0)
+
+static void blake2s_compress(blake2s_state *S, const uint8_t *block, int last) {
+    uint32_t m[16], v[16];
+
+    for (int i = 0; i < 16; i++) m[i] = load32(block + 4 * i);
+    for (int i = 0; i < 8; i++) {
+        v[i] = S->h[i];
+        v[i + 8] = blake2s_iv[i];
+    }
+    v[12] ^= S->t[0];
+    v[13] ^= S->t[1];
+    if (last) v[14] = ~v[14];
+
+    for (int r = 0; r < 10; r++) {
+        const uint8_t *s = blake2s_sigma[r];
+        G(v[0], v[4], v[ 8], v[12], m[s[ 0]], m[s[ 1]]);
+        G(v[1], v[5], v[ 9], v[13], m[s[ 2]], m[s[ 3]]);
+        G(v[2], v[6], v[10], v[14], m[s[ 4]], m[s[ 5]]);
+        G(v[3], v[7], v[11], v[15], m[s[ 6]], m[s[ 7]]);
+        G(v[0], v[5], v[10], v[15], m[s[ 8]], m[s[ 9]]);
+        G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        G(v[2], v[7], v[ 8], v[13], m[s[12]], m[s[13]]);
+        G(v[3], v[4], v[ 9], v[14], m[s[14]], m[s[15]]);
+    }
+
+    for (int i = 0; i < 8; i++) S->h[i] ^= v[i] ^ v[i + 8];
+}
+
+static void blake2s_add_counter(blake2s_state *S, uint32_t inc) {
+    S->t[0] += inc;
+    if (S->t[0] < inc) S->t[1]++;
+}
+
+void blake2s_init(blake2s_state *S, uint32_t outlen) {
+    memset(S, 0, sizeof(*S));
+    for (int i = 0; i < 8; i++) S->h[i] = blake2s_iv[i];
+    S->h[0] ^= 0x01010000 ^ outlen;  /* depth 1, fanout 1, no key */
+    S->outlen = outlen;
+}
+
+void blake2s_update(blake2s_state *S, const void *in, size_t inlen) {
+    const uint8_t *p = in;
+
+    while (inlen > 0) {
+        /* The last block must go through final(), so only compress a full
+         * buffer once more input is known to follow. */
+        if (S->buflen == BLAKE2S_BLOCKBYTES) {
+            blake2s_add_counter(S, BLAKE2S_BLOCKBYTES);
+            blake2s_compress(S, S->buf, 0);
+            S->buflen = 0;
+        }
+
+        size_t take = BLAKE2S_BLOCKBYTES - S->buflen;
+        if (take > inlen) take = inlen;
+        memcpy(S->buf + S->buflen, p, take);
+        S->buflen += take;
+        p += take;
+        inlen -= take;
+    }
+}
+
+void blake2s_final(blake2s_state *S, void *out) {
+    uint8_t digest[BLAKE2S_OUTBYTES];
+
+    blake2s_add_counter(S, S->buflen);
+    memset(S->buf + S->buflen, 0, BLAKE2S_BLOCKBYTES - S->buflen);
+    blake2s_compress(S, S->buf, 1);
+
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i + 0] = (uint8_t)(S->h[i]);
+        digest[4 * i + 1] = (uint8_t)(S->h[i] >> 8);
+        digest[4 * i + 2] = (uint8_t)(S->h[i] >> 16);
+        digest[4 * i + 3] = (uint8_t)(S->h[i] >> 24);
+    }
+    memcpy(out, digest, S->outlen);
+}
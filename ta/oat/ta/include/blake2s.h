@@ -0,0 +1,26 @@
+/* include/blake2s.h */
+#ifndef BLAKE2S_H
+#define BLAKE2S_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* BLAKE2s (RFC 7693), unkeyed, the paper's measurement hash.
+ * Runs entirely inside the TA: no TEE core syscall per update. */
+
+#define BLAKE2S_BLOCKBYTES 64
+#define BLAKE2S_OUTBYTES   32
+
+typedef struct {
+    uint32_t h[8];
+    uint32_t t[2];
+    uint8_t buf[BLAKE2S_BLOCKBYTES];
+    uint32_t buflen;
+    uint32_t outlen;
+} blake2s_state;
+
+void blake2s_init(blake2s_state *S, uint32_t outlen);
+void blake2s_update(blake2s_state *S, const void *in, size_t inlen);
+void blake2s_final(blake2s_state *S, void *out);
+
+#endif /* BLAKE2S_H */
@@ -2,7 +2,7 @@
 #ifndef OAT_TA_H  /* <--- CHANGED FROM USER_TA_HEADER_DEFINES_H */
 #define OAT_TA_H
 
-
+#include <stdint.h>
 
 /* The UUID */
 #define TA_OAT_UUID \
@@ -17,10 +17,142 @@
 #define CMD_STACK_POP    0x11
 #define CMD_INDIRECT_CALL 0x12
 #define CMD_GET_LOG       0x13
+#define CMD_EVENT_BATCH   0x14
+#define CMD_HASH_BENCH    0x15
+#define CMD_HASH_RELEASE  0x16
+#define CMD_HASH_SEAL     0x17
+#define CMD_HASH_PREPARE  0x18
+
+/* Measurement hash backends (CMD_HASH_INIT value.a, default SHA-256).
+ * The ID is the first thing hashed, so it is bound into the proof. */
+#define OAT_HASH_SHA256   0
+#define OAT_HASH_BLAKE2S  1
+#define OAT_HASH_SIZE     32
+
+/* Batched events (CMD_EVENT_BATCH)
+ * The host appends one record per hook into a registered shared-memory
+ * buffer and hands the whole buffer to the TA in a single invocation.
+ * Each record mirrors the value parameter of the matching single-event
+ * command, so the TA hashes exactly the same bytes either way.
+ */
+#define EVT_BRANCH        0x01  /* a = decision (0/1)             */
+#define EVT_STACK_PUSH    0x02  /* a = func_id (16-bit)           */
+#define EVT_STACK_POP     0x03  /* a = func_id (16-bit)           */
+#define EVT_INDIRECT_CALL 0x04  /* a = target[31:0], b = [63:32]  */
+#define EVT_LOOP          0x05  /* a = loop site, b = trip count  */
+#define EVT_INDIRECT_IDX  0x06  /* a = call site, b = table index */
+#define EVT_CVI_DEF       0x07  /* a = var | offset << 16, b = value stored */
+#define EVT_CVI_USE       0x08  /* a = var | offset << 16, b = value loaded */
+#define EVT_CVI_FORGET    0x09  /* a = var                        */
+#define EVT_BRANCH_BITS   0x0A  /* a = decisions LSB-first, b = count (1..32) */
+#define EVT_THREAD_EXIT   0x0B  /* thread ID is being released    */
+#define EVT_PATH          0x0C  /* a = function site, b = Ball-Larus path ID */
+
+/* Threads: CMD_EVENT_BATCH takes the application thread's ID
+ * (0 .. OAT_MAX_THREADS-1) in params[2].value.a, 0 if params[2] is not
+ * VALUE_INPUT. Each thread has its own shadow stack. Its events go to its
+ * own stream of the operation, which starts with its first event there
+ * and ends at EVT_THREAD_EXIT, when the ID may be handed to a new thread
+ * with a new stream. An operation holds up to OAT_MAX_STREAMS streams;
+ * see final_proof() in oat_ta.c for how CMD_HASH_FINAL combines them.
+ *
+ * CMD_GET_LOG names a stream in params[2].value.a: its index in start
+ * order (the thread that started the operation is stream 0), or
+ * OAT_LOG_THREAD | thread ID for that thread's current stream.
+ * TEE_ERROR_ITEM_NOT_FOUND past the last stream. With params[3]
+ * VALUE_OUTPUT, value.a returns how many streams the operation has. */
+#define OAT_MAX_THREADS   16
+#define OAT_MAX_STREAMS   32
+#define OAT_LOG_THREAD    0x80000000u
+
+/* Operations: op 0 is restarted by a plain CMD_HASH_INIT. With params[1]
+ * VALUE_OUTPUT, CMD_HASH_INIT instead takes a free op from the pool and
+ * returns its ID in params[1].value.a (TEE_ERROR_OUT_OF_MEMORY when all
+ * are in use). Either way the op is measured from the start by the thread
+ * in params[2].value.a. Batches and CMD_GET_LOG
+ * name the op in params[2].value.b, CMD_HASH_FINAL in params[1] VALUE_INPUT
+ * (op 0 if absent), and CMD_HASH_RELEASE (params[0].value.a) returns it to
+ * the pool. Shadow stacks and CVI values are shared by all ops.
+ *
+ * CMD_HASH_SEAL stops the op in params[0].value.a and moves its
+ * measurement to a free pooled op, returned in params[1].value.a
+ * (TEE_ERROR_OUT_OF_MEMORY when none is free). The sealed op takes no
+ * more events; its proof and log are read and it is released as above,
+ * while the original ID can be started again right away. With
+ * OAT_SEAL_COPY in params[0].value.b the pooled op gets a copy instead
+ * (digest states, counts and traces as they are now) and the original
+ * keeps measuring, for ops other threads are still on.
+ *
+ * CMD_HASH_PREPARE allocates ahead of time what operations otherwise
+ * allocate on first use: for every op, the digest handles of streams
+ * 0 .. params[0].value.b-1 for backend params[0].value.a, and
+ * params[1].value.a bytes (VALUE_INPUT, optional) of each of their trace
+ * sections. Restarting an op resets all of it in place. */
+#define OAT_MAX_OPS       4
+#define OAT_SEAL_COPY     1
+
+/* Index the pass reports for an indirect target that is not in its call
+ * site's table. The TA rejects it on arrival (TEE_ERROR_SECURITY). */
+#define OAT_ICALL_UNLISTED 0xFF
+
+/* Critical Variable Integrity (oat-pass on annotate("sensitive") globals).
+ * Values are folded to 32 bits by the pass; only 'D'/'U' and the 16-bit
+ * variable ID are hashed, so proofs do not depend on the data. The TA
+ * keeps the last defined value per (var, offset) for the whole session
+ * and fails a use that differs (TEE_ERROR_SECURITY). A use with no def
+ * yet (static initializer, or after a forget) is adopted as the value. */
+#define OAT_CVI_MAX_VARS  256
+#define OAT_CVI_SLOTS     1024  /* tracked (var, offset) pairs, power of 2 */
+
+struct oat_event {
+    uint32_t tag;
+    uint32_t a;
+    uint32_t b;
+};
+
+/* Measurement blob returned by CMD_GET_LOG (little-endian, paper format)
+ *
+ *   uint32_t n_addr;            Size(S_addr): number of indirect targets
+ *   uint64_t addr[n_addr];      S_addr: targets in execution order
+ *   uint32_t n_bits;            Size(S_bin): number of branch decisions
+ *   uint8_t  bin[(n_bits+7)/8]; S_bin: decision i is bit (i % 8) of byte i / 8
+ *   uint32_t n_loops;           Size(S_loop): number of compressed loop exits
+ *   struct oat_loop_record loop[n_loops];
+ *                               S_loop: in loop-exit order
+ *   uint32_t n_icalls;          Size(S_icall): number of table-indexed calls
+ *   uint8_t  icall[n_icalls];   S_icall: target index into the call site's
+ *                               .oat_icall table, in execution order
+ *   uint32_t n_paths;           Size(S_path): number of acyclic paths
+ *   struct oat_path_record path[n_paths];
+ *                               S_path: in path-end order
+ *
+ * Indirect calls whose site has a target table (EVT_INDIRECT_IDX) go to
+ * S_icall; sites the pass could not tabulate still log raw addresses into
+ * S_addr. Returns are hash-only and never appear in the blob.
+ *
+ * CMD_GET_LOG reads it a page at a time: params[1] is VALUE_INOUT, and
+ * the call copies the bytes at offset params[1].value.a into params[0]
+ * (as many as fit) and returns value.a = bytes still remaining, value.b =
+ * events that were hashed but not recorded because the trace hit
+ * OAT_TRACE_LIMIT (0 for a complete trace).
+ *
+ * When CMD_EVENT_BATCH fails, params[1].value.a is the index of the
+ * rejected event and params[1].value.b its tag.
+ */
+
+/* One exit of a loop compressed by the pass (oat-pass<loop-compress>):
+ * the exiting branch stayed in the loop `trips` times, then left. */
+struct oat_loop_record {
+    uint32_t site;
+    uint32_t trips;
+};
 
-/* Log Tags (for parsing the binary) */
-#define TAG_BRANCH        0x01
-#define TAG_INDIRECT      0x02
-#define TAG_STACK_POP     0x03
+/* One acyclic path through a function numbered by the pass
+ * (oat-pass<path-log>), reported where the path ends: at a loop back edge
+ * or a return. Its branch decisions are not logged individually. */
+struct oat_path_record {
+    uint32_t site;
+    uint32_t path;
+};
 
 #endif /* OAT_TA_H */
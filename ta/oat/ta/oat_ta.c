@@ -2,19 +2,155 @@
 #include <tee_internal_api.h>
 #include <tee_internal_api_extensions.h>
 #include <oat_ta.h>
+#include <blake2s.h>
 
-#define MAX_STACK_DEPTH 128
-#define MAX_LOG_SIZE    8192  // 8KB Log Buffer
+/* Shadow stack: OAT_STACK_WINDOW entries live in the session context;
+ * older ones are spilled to the TA heap OAT_STACK_CHUNK at a time, each
+ * chunk its own allocation (never reallocated, so never copied), up to
+ * OAT_STACK_SPILL_LIMIT bytes over all threads of the session (override
+ * in sub.mk like OAT_TRACE_LIMIT). Each entry is a run of identical
+ * frames, so direct recursion costs one entry at any depth. */
+#define OAT_STACK_WINDOW 64
+#define OAT_STACK_CHUNK  (OAT_STACK_WINDOW / 2)
+#ifndef OAT_STACK_SPILL_LIMIT
+#define OAT_STACK_SPILL_LIMIT (128 * 1024)
+#endif
 
+/* Upper bound on the trace memory of the whole session: S_addr + S_bin +
+ * S_loop + S_icall + S_path capacity of every thread of every operation.
+ * The sections live on the TA heap and grow on demand within it; override
+ * with cflags-y += -DOAT_TRACE_LIMIT=<bytes> in sub.mk. The two limits
+ * are separate so a long trace cannot take the heap the shadow stack
+ * needs. Growing a section with TEE_Realloc briefly holds its old and new
+ * buffer, so a growth is only made if, with the old one still counted, it
+ * stays under OAT_TRACE_PEAK. TA_DATA_SIZE must cover that peak, the
+ * spill limit and the contexts. */
+#ifndef OAT_TRACE_LIMIT
+#define OAT_TRACE_LIMIT (256 * 1024)
+#endif
+#define OAT_TRACE_PEAK  (OAT_TRACE_LIMIT + OAT_TRACE_LIMIT / 2)
+#define TRACE_MIN_CAP   256
+
+#define HASH_BLOCK_SIZE 64
+#define HASH_STAGE_SIZE (4 * HASH_BLOCK_SIZE)
+
+/* Measurement hash backend, chosen per session at CMD_HASH_INIT */
 typedef struct {
-    uint32_t shadow_stack[MAX_STACK_DEPTH];
-    int stack_ptr;
-    TEE_OperationHandle op_handle;
-    bool is_crypto_initialized;
-    
-    // NEW: Log Storage
-    uint8_t execution_log[MAX_LOG_SIZE];
-    uint32_t log_idx;
+    uint32_t alg;                  // OAT_HASH_*
+    TEE_OperationHandle op_handle; // OAT_HASH_SHA256 (GP API)
+    blake2s_state b2s;             // OAT_HASH_BLAKE2S (in-TA)
+
+    // Every TEE_DigestUpdate is a syscall into the TEE core, so GP-backed
+    // events collect here and reach the digest in whole blocks only
+    uint8_t stage[HASH_STAGE_SIZE];
+    uint32_t stage_len;
+} oat_hash_ctx;
+
+/* Last attested value of one (var, offset) of a sensitive variable. A slot
+ * is live while its epoch matches the variable's; forgetting a variable
+ * just bumps its epoch. Epoch 0 marks a slot that was never used. */
+typedef struct {
+    uint32_t key;   // var | offset << 16
+    uint32_t value;
+    uint32_t epoch;
+} oat_cvi_slot;
+
+/* One growable trace section. Capacity is kept across operations, so a
+ * steady-state operation does not touch the allocator. */
+typedef struct {
+    uint8_t *data;
+    uint32_t len;   // bytes used
+    uint32_t cap;   // bytes allocated
+} oat_trace_buf;
+
+/* Heap held by the session's traces and shadow stack spill, each kept
+ * under its own limit */
+typedef struct {
+    uint32_t trace; // trace section capacity, all ops and threads
+    uint32_t spill; // spill chunk capacity, all threads
+} oat_heap_use;
+
+/* `count` consecutive frames of function `id` (dense 16-bit pass IDs) */
+typedef struct {
+    uint16_t id;
+    uint16_t count;
+} oat_frame;
+
+/* Spilled frames, chained: `chain` in the shadow stack is the BLAKE2s of
+ * the newest chunk, whose `prev` is the chain value before it. A chunk
+ * refilled from the heap must hash back to the chain value. */
+typedef struct {
+    uint8_t prev[OAT_HASH_SIZE];
+    oat_frame frames[OAT_STACK_CHUNK];
+} oat_stack_chunk;
+
+/* Shadow stack of one application thread, by the ID liboat sends with
+ * its batches. It follows the thread's call chain, whichever operation
+ * the events are measured into. */
+typedef struct {
+    oat_frame frames[OAT_STACK_WINDOW];
+    int ptr;                        // resident entries in use
+    oat_stack_chunk **spill;        // older entries, oldest chunk first
+    uint32_t spilled;               // chunks in use
+    uint32_t spill_cap;             // chunks allocated, kept for reuse
+    uint32_t spill_slots;           // entries in `spill`
+    uint8_t chain[OAT_HASH_SIZE];
+    oat_heap_use *heap;             // the session's
+} oat_shadow_stack;
+
+/* One stream of an operation: what one application thread measured into
+ * it, from its first event to its exit or the proof, and that thread's
+ * shadow stack for the handlers to check against. */
+typedef struct {
+    oat_shadow_stack *stack;
+    oat_heap_use *heap;         // the session's
+    oat_hash_ctx hash;
+    bool is_measuring;          // hash started, thread still running
+    bool finished;              // thread exited, `digest` is its result
+    uint8_t digest[OAT_HASH_SIZE];
+
+    // Forward-edge trace (paper's measurement blob)
+    oat_trace_buf trace_bin;    // 1 bit per conditional branch
+    uint32_t bin_bits;
+    oat_trace_buf trace_addr;   // uint64_t per indirect call
+    uint32_t addr_count;
+    oat_trace_buf trace_loop;   // struct oat_loop_record per compressed loop
+    uint32_t loop_count;
+    oat_trace_buf trace_icall;  // uint8_t table index per tabulated indirect call
+    uint32_t icall_count;
+    oat_trace_buf trace_path;   // struct oat_path_record per numbered path
+    uint32_t path_count;
+    uint32_t trace_lost;        // events hashed but not recorded (limit hit)
+} oat_thread_ctx;
+
+/* One attested operation. Op 0 is the legacy one, restarted by every
+ * plain CMD_HASH_INIT; the others are handed out by CMD_HASH_INIT and held
+ * until CMD_HASH_RELEASE, so operations can overlap. A thread ID is
+ * recycled when its thread exits, so streams are kept in start order and
+ * a thread ID only points at its current one. */
+typedef struct {
+    oat_thread_ctx *streams[OAT_MAX_STREAMS]; // allocated on first use, then kept
+    uint32_t n_streams;         // started in this operation
+    uint8_t live[OAT_MAX_THREADS]; // thread ID -> stream index + 1, 0 if none
+    uint32_t alg;               // OAT_HASH_* of this operation
+    oat_hash_ctx combine;       // final_proof() of several threads
+    bool is_crypto_initialized; // started (CMD_HASH_INIT) and not released
+    bool sealed;                // moved here by CMD_HASH_SEAL, takes no events
+} oat_op_ctx;
+
+typedef struct {
+    oat_shadow_stack stacks[OAT_MAX_THREADS];
+    oat_op_ctx *ops[OAT_MAX_OPS]; // by ID; CMD_HASH_SEAL swaps two entries
+
+    // CVI shadow values, kept across operations like the shadow stack
+    oat_cvi_slot cvi_slots[OAT_CVI_SLOTS];
+    uint32_t cvi_epoch[OAT_CVI_MAX_VARS];
+    bool cvi_full_reported;
+
+    oat_heap_use heap;
+    // Events of an op that is not started are checked against the
+    // sending thread's shadow stack here, and measured nowhere
+    oat_thread_ctx unmeasured;
 } oat_session_ctx;
 
 /* Entry Points (Boilerplate) */
@@ -23,61 +159,997 @@ void TA_DestroyEntryPoint(void) { }
 
 TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types, TEE_Param params[4], void **sess_ctx) {
     (void)&param_types; (void)&params;
-    oat_session_ctx *ctx = TEE_Malloc(sizeof(oat_session_ctx), 0);
+    oat_session_ctx *ctx = TEE_Malloc(sizeof(oat_session_ctx), TEE_MALLOC_FILL_ZERO);
     if (!ctx) return TEE_ERROR_OUT_OF_MEMORY;
     
-    ctx->stack_ptr = 0;
-    ctx->log_idx = 0;
-    ctx->op_handle = TEE_HANDLE_NULL;
-    ctx->is_crypto_initialized = false;
+    for (uint32_t o = 0; o < OAT_MAX_OPS; o++) {
+        oat_op_ctx *op = TEE_Malloc(sizeof(oat_op_ctx), TEE_MALLOC_FILL_ZERO);
+        if (!op) {
+            while (o--) TEE_Free(ctx->ops[o]);
+            TEE_Free(ctx);
+            return TEE_ERROR_OUT_OF_MEMORY;
+        }
+        ctx->ops[o] = op;
+        op->alg = OAT_HASH_SHA256;
+        op->combine.op_handle = TEE_HANDLE_NULL;
+        op->is_crypto_initialized = false;
+        op->sealed = false;
+    }
+    for (uint32_t i = 0; i < OAT_MAX_THREADS; i++) ctx->stacks[i].heap = &ctx->heap;
+    ctx->unmeasured.heap = &ctx->heap;
+    ctx->unmeasured.hash.op_handle = TEE_HANDLE_NULL;
+    for (uint32_t i = 0; i < OAT_CVI_MAX_VARS; i++) ctx->cvi_epoch[i] = 1;
     *sess_ctx = (void *)ctx;
     return TEE_SUCCESS;
 }
 
 void TA_CloseSessionEntryPoint(void *sess_ctx) {
     oat_session_ctx *ctx = (oat_session_ctx *)sess_ctx;
-    if (ctx->op_handle != TEE_HANDLE_NULL) TEE_FreeOperation(ctx->op_handle);
+    for (uint32_t i = 0; i < OAT_MAX_THREADS; i++) {
+        for (uint32_t c = 0; c < ctx->stacks[i].spill_cap; c++) TEE_Free(ctx->stacks[i].spill[c]);
+        TEE_Free(ctx->stacks[i].spill);
+    }
+    for (uint32_t o = 0; o < OAT_MAX_OPS; o++) {
+        oat_op_ctx *op = ctx->ops[o];
+        if (op->combine.op_handle != TEE_HANDLE_NULL)
+            TEE_FreeOperation(op->combine.op_handle);
+        for (uint32_t i = 0; i < OAT_MAX_STREAMS; i++) {
+            oat_thread_ctx *t = op->streams[i];
+            if (!t) continue;
+            if (t->hash.op_handle != TEE_HANDLE_NULL) TEE_FreeOperation(t->hash.op_handle);
+            TEE_Free(t->trace_bin.data);
+            TEE_Free(t->trace_addr.data);
+            TEE_Free(t->trace_loop.data);
+            TEE_Free(t->trace_icall.data);
+            TEE_Free(t->trace_path.data);
+            TEE_Free(t);
+        }
+        TEE_Free(op);
+    }
     TEE_Free(ctx);
 }
 
+/* --- Hash Backends --- */
+
+/* A GP digest handle is allocated the first time and reset in place after
+ * that, so restarting a measurement does not touch the TEE heap. */
+static TEE_Result oat_hash_init(oat_hash_ctx *h, uint32_t alg) {
+    switch (alg) {
+        case OAT_HASH_SHA256: {
+            if (h->op_handle != TEE_HANDLE_NULL) {
+                TEE_ResetOperation(h->op_handle);
+                break;
+            }
+            TEE_Result res = TEE_AllocateOperation(&h->op_handle, TEE_ALG_SHA256, TEE_MODE_DIGEST, 0);
+            if (res != TEE_SUCCESS) return res;
+            break;
+        }
+        case OAT_HASH_BLAKE2S:
+            blake2s_init(&h->b2s, BLAKE2S_OUTBYTES);
+            break;
+        default:
+            return TEE_ERROR_NOT_SUPPORTED;
+    }
+    h->alg = alg;
+    h->stage_len = 0;
+    return TEE_SUCCESS;
+}
+
+/* Hashing the concatenation in block-sized pieces gives the same digest
+ * as per-event updates, so staging does not change any proof. */
+static void oat_hash_update(oat_hash_ctx *h, const void *data, size_t size) {
+    if (h->alg == OAT_HASH_BLAKE2S) {
+        blake2s_update(&h->b2s, data, size);
+        return;
+    }
+
+    const uint8_t *p = data;
+    while (size > 0) {
+        uint32_t take = HASH_STAGE_SIZE - h->stage_len;
+        if (take > size) take = size;
+        TEE_MemMove(&h->stage[h->stage_len], p, take);
+        h->stage_len += take;
+        p += take;
+        size -= take;
+
+        if (h->stage_len == HASH_STAGE_SIZE) {
+            TEE_DigestUpdate(h->op_handle, h->stage, HASH_STAGE_SIZE);
+            h->stage_len = 0;
+        }
+    }
+}
+
+/* Leaves the backend ready for a new (discarded) stream, as GP digests do */
+static TEE_Result oat_hash_final(oat_hash_ctx *h, void *out, uint32_t *out_size) {
+    if (*out_size < OAT_HASH_SIZE) {
+        *out_size = OAT_HASH_SIZE;
+        return TEE_ERROR_SHORT_BUFFER;
+    }
+    if (h->alg == OAT_HASH_BLAKE2S) {
+        blake2s_final(&h->b2s, out);
+        blake2s_init(&h->b2s, BLAKE2S_OUTBYTES);
+        *out_size = OAT_HASH_SIZE;
+        return TEE_SUCCESS;
+    }
+    // The partial tail goes in with the final call, no extra syscall
+    TEE_Result res = TEE_DigestDoFinal(h->op_handle, h->stage, h->stage_len, out, out_size);
+    h->stage_len = 0;
+    return res;
+}
+
+/* `dst` continues exactly where `src` is now */
+static TEE_Result oat_hash_copy(oat_hash_ctx *dst, const oat_hash_ctx *src) {
+    TEE_Result res = oat_hash_init(dst, src->alg);
+    if (res != TEE_SUCCESS) return res;
+    if (src->alg == OAT_HASH_BLAKE2S) dst->b2s = src->b2s;
+    else TEE_CopyOperation(dst->op_handle, src->op_handle);
+    TEE_MemMove(dst->stage, src->stage, src->stage_len);
+    dst->stage_len = src->stage_len;
+    return TEE_SUCCESS;
+}
+
+static void oat_hash_free(oat_hash_ctx *h) {
+    if (h->op_handle != TEE_HANDLE_NULL) TEE_FreeOperation(h->op_handle);
+    h->op_handle = TEE_HANDLE_NULL;
+}
+
 /* --- Helpers --- */
 
-static TEE_Result init_session(oat_session_ctx *ctx) {
-    /* NOTE: Do NOT reset stack_ptr here. The shadow stack must persist
+/* Stream slot `i` of an operation, allocated the first time it is used
+ * and kept, with its digest handle and trace capacity, for later ones */
+static TEE_Result stream_slot(oat_op_ctx *op, oat_heap_use *heap, uint32_t i, oat_thread_ctx **t) {
+    if (!op->streams[i]) {
+        oat_thread_ctx *n = TEE_Malloc(sizeof(oat_thread_ctx), TEE_MALLOC_FILL_ZERO);
+        if (!n) return TEE_ERROR_OUT_OF_MEMORY;
+        n->heap = heap;
+        n->hash.alg = OAT_HASH_SHA256;
+        n->hash.op_handle = TEE_HANDLE_NULL;
+        op->streams[i] = n;
+    }
+    *t = op->streams[i];
+    return TEE_SUCCESS;
+}
+
+/* A thread's measurement starts with its first event of the operation
+ * (the starting thread's at CMD_HASH_INIT), in a new stream that begins
+ * with the algorithm ID like any other. */
+static TEE_Result thread_begin(oat_session_ctx *ctx, oat_op_ctx *op, uint32_t tid) {
+    if (op->n_streams == OAT_MAX_STREAMS) {
+        EMSG("More than %u threads measured in one operation", OAT_MAX_STREAMS);
+        return TEE_ERROR_OUT_OF_MEMORY;
+    }
+    oat_thread_ctx *t;
+    TEE_Result res = stream_slot(op, &ctx->heap, op->n_streams, &t);
+    if (res != TEE_SUCCESS) return res;
+
+    res = oat_hash_init(&t->hash, op->alg);
+    if (res != TEE_SUCCESS) return res;
+
+    /* Trace capacity is kept; only the lengths start over */
+    t->bin_bits = 0;
+    t->addr_count = 0;
+    t->loop_count = 0;
+    t->icall_count = 0;
+    t->path_count = 0;
+    t->trace_bin.len = 0;
+    t->trace_addr.len = 0;
+    t->trace_loop.len = 0;
+    t->trace_icall.len = 0;
+    t->trace_path.len = 0;
+    t->trace_lost = 0;
+    t->stack = &ctx->stacks[tid];
+    t->finished = false;
+
+    // Bind the algorithm into the proof: the stream starts with its ID
+    oat_hash_update(&t->hash, &op->alg, sizeof(uint32_t));
+    t->is_measuring = true;
+    op->live[tid] = ++op->n_streams;
+    return TEE_SUCCESS;
+}
+
+/* The stream events from thread `tid` go to: its current one, a new one
+ * if it has none yet, or nowhere while the op is not started. */
+static TEE_Result thread_stream(oat_session_ctx *ctx, oat_op_ctx *op, uint32_t tid,
+                                oat_thread_ctx **t) {
+    if (op->is_crypto_initialized && !op->live[tid]) {
+        TEE_Result res = thread_begin(ctx, op, tid);
+        if (res != TEE_SUCCESS) return res;
+    }
+    if (op->live[tid]) {
+        *t = op->streams[op->live[tid] - 1];
+    } else {
+        *t = &ctx->unmeasured;
+        (*t)->stack = &ctx->stacks[tid];
+    }
+    return TEE_SUCCESS;
+}
+
+/* Thread `tid` exited: its stream is closed with the digest so far, and a
+ * thread that gets the ID next starts its own */
+static TEE_Result thread_end(oat_op_ctx *op, uint32_t tid) {
+    if (!op->live[tid]) return TEE_SUCCESS;
+    oat_thread_ctx *t = op->streams[op->live[tid] - 1];
+    op->live[tid] = 0;
+
+    uint32_t size = OAT_HASH_SIZE;
+    TEE_Result res = oat_hash_final(&t->hash, t->digest, &size);
+    if (res != TEE_SUCCESS) return res;
+    t->is_measuring = false;
+    t->finished = true;
+    return TEE_SUCCESS;
+}
+
+static TEE_Result init_op(oat_session_ctx *ctx, oat_op_ctx *op, uint32_t alg, uint32_t tid) {
+    /* NOTE: Do NOT reset the shadow stacks here. They must persist
      * across the entire program lifetime for ROP detection. Only the
      * hash and log reset per-operation. */
-    ctx->log_idx = 0; // Reset Log
-    
-    if (ctx->op_handle != TEE_HANDLE_NULL) TEE_FreeOperation(ctx->op_handle);
-    TEE_Result res = TEE_AllocateOperation(&ctx->op_handle, TEE_ALG_SHA256, TEE_MODE_DIGEST, 0);
+    for (uint32_t i = 0; i < op->n_streams; i++) {
+        op->streams[i]->is_measuring = false;
+        op->streams[i]->finished = false;
+    }
+    op->n_streams = 0;
+    TEE_MemFill(op->live, 0, sizeof(op->live));
+
+    op->alg = alg;
+    op->is_crypto_initialized = true;
+    op->sealed = false;
+    TEE_Result res = thread_begin(ctx, op, tid);
+    if (res != TEE_SUCCESS) op->is_crypto_initialized = false;
+    return res;
+}
+
+static void update_running_hash(oat_thread_ctx *t, void* data, size_t size) {
+    if (!t->is_measuring) return;
+    oat_hash_update(&t->hash, data, size);
+}
+
+/* Hash a synthetic stream shaped like a syringe bolus (B.Cond:Ret ~ 1:4,
+ * every return paired with an enter, 16-bit function IDs) with one update per event, the way
+ * the command handlers do. Returns elapsed wall time in ms.
+ */
+static TEE_Result run_hash_bench(uint32_t alg, uint32_t events, uint32_t *elapsed_ms) {
+    oat_hash_ctx h = { .op_handle = TEE_HANDLE_NULL };
+    uint8_t digest[OAT_HASH_SIZE];
+    uint32_t digest_size = sizeof(digest);
+    TEE_Time start, end;
+    char decision;
+    uint16_t id;
+
+    TEE_Result res = oat_hash_init(&h, alg);
     if (res != TEE_SUCCESS) return res;
 
-    TEE_DigestUpdate(ctx->op_handle, NULL, 0); 
-    ctx->is_crypto_initialized = true;
+    TEE_GetSystemTime(&start);
+    for (uint32_t i = 0; i < events; i++) {
+        switch (i % 9) {
+            case 0:
+                decision = (i & 0x10) ? '1' : '0';
+                oat_hash_update(&h, &decision, 1);
+                break;
+            default:
+                id = 0x20 + (i % 9) / 2;
+                oat_hash_update(&h, &id, sizeof(uint16_t));
+                break;
+        }
+    }
+    res = oat_hash_final(&h, digest, &digest_size);
+    TEE_GetSystemTime(&end);
+    oat_hash_free(&h);
+
+    *elapsed_ms = (end.seconds - start.seconds) * 1000 + end.millis - start.millis;
+    return res;
+}
+
+static uint32_t trace_bytes(oat_thread_ctx *t) {
+    return t->trace_bin.len + t->trace_addr.len + t->trace_loop.len +
+           t->trace_icall.len + t->trace_path.len;
+}
+
+/* Grow a section to `cap` bytes, within what OAT_TRACE_LIMIT leaves of
+ * the session's trace memory (never shrinks) */
+static TEE_Result trace_grow(oat_heap_use *heap, oat_trace_buf *buf, uint32_t cap) {
+    if (cap <= buf->cap) return TEE_SUCCESS;
+    if (cap - buf->cap > OAT_TRACE_LIMIT - heap->trace) return TEE_ERROR_OVERFLOW;
+    if (cap > OAT_TRACE_PEAK - heap->trace) return TEE_ERROR_OVERFLOW;
+    uint8_t *data = TEE_Realloc(buf->data, cap);
+    if (!data) return TEE_ERROR_OUT_OF_MEMORY;
+    heap->trace += cap - buf->cap;
+    buf->data = data;
+    buf->cap = cap;
     return TEE_SUCCESS;
 }
 
-static void update_running_hash(oat_session_ctx *ctx, void* data, size_t size) {
-    if (!ctx->is_crypto_initialized) return;
-    TEE_DigestUpdate(ctx->op_handle, data, size);
+/* Make room for `size` more bytes in one section. Fails once the session's
+ * traces would exceed OAT_TRACE_LIMIT or the heap is exhausted; the event
+ * is then counted in trace_lost (it is still hashed) and GET_LOG reports
+ * the loss, so a truncated trace is never mistaken for a complete one. */
+static bool trace_reserve(oat_thread_ctx *t, oat_trace_buf *buf, uint32_t size) {
+    if (!t->is_measuring) return false;
+    if (buf->len + size <= buf->cap) return true;
+
+    // Double, but never past what the limit (or, while the old buffer is
+    // copied, the peak) leaves
+    uint32_t max = buf->cap + (OAT_TRACE_LIMIT - t->heap->trace);
+    uint32_t peak = OAT_TRACE_PEAK - t->heap->trace;
+    uint32_t cap = buf->cap ? buf->cap : TRACE_MIN_CAP;
+    while (cap < buf->len + size) cap *= 2;
+    if (cap > max) cap = max;
+    if (cap > peak) cap = peak;
+
+    if (buf->len + size <= cap && trace_grow(t->heap, buf, cap) == TEE_SUCCESS) return true;
+
+    if (t->trace_lost++ == 0)
+        EMSG("OAT trace limit reached (%u bytes in this thread, %u in the session), "
+             "further events are hash-only", trace_bytes(t), t->heap->trace);
+    return false;
 }
 
-// NEW: Append to internal log buffer
-static void append_log(oat_session_ctx *ctx, uint8_t tag, void* data, uint32_t size) {
-    // Check for overflow (1 byte tag + payload size)
-    if (ctx->log_idx + 1 + size > MAX_LOG_SIZE) {
-        EMSG("OAT Log Overflow! Dropping event.");
-        return; 
+// Append one branch decision to S_bin (LSB-first within each byte)
+static void append_branch_bit(oat_thread_ctx *t, uint8_t bit) {
+    uint32_t byte = t->bin_bits / 8;
+    if (byte == t->trace_bin.len) {
+        if (!trace_reserve(t, &t->trace_bin, 1)) return;
+        t->trace_bin.data[t->trace_bin.len++] = 0;
     }
-    
-    // Write Tag
-    ctx->execution_log[ctx->log_idx++] = tag;
-    
-    // Write Data
-    if (size > 0 && data != NULL) {
-        TEE_MemMove(&ctx->execution_log[ctx->log_idx], data, size);
-        ctx->log_idx += size;
+
+    if (bit) t->trace_bin.data[byte] |= (uint8_t)(1u << (t->bin_bits % 8));
+    t->bin_bits++;
+}
+
+// Append one indirect-call target to S_addr
+static void append_indirect_addr(oat_thread_ctx *t, uint64_t addr) {
+    if (!trace_reserve(t, &t->trace_addr, sizeof(uint64_t))) return;
+    TEE_MemMove(t->trace_addr.data + t->trace_addr.len, &addr, sizeof(uint64_t));
+    t->trace_addr.len += sizeof(uint64_t);
+    t->addr_count++;
+}
+
+// Append one compressed-loop exit to S_loop
+static void append_loop(oat_thread_ctx *t, uint32_t site, uint32_t trips) {
+    struct oat_loop_record rec = { site, trips };
+    if (!trace_reserve(t, &t->trace_loop, sizeof(rec))) return;
+    TEE_MemMove(t->trace_loop.data + t->trace_loop.len, &rec, sizeof(rec));
+    t->trace_loop.len += sizeof(rec);
+    t->loop_count++;
+}
+
+// Append one table index to S_icall
+static void append_icall_idx(oat_thread_ctx *t, uint8_t idx) {
+    if (!trace_reserve(t, &t->trace_icall, 1)) return;
+    t->trace_icall.data[t->trace_icall.len++] = idx;
+    t->icall_count++;
+}
+
+// Append one numbered path to S_path
+static void append_path(oat_thread_ctx *t, uint32_t site, uint32_t path) {
+    struct oat_path_record rec = { site, path };
+    if (!trace_reserve(t, &t->trace_path, sizeof(rec))) return;
+    TEE_MemMove(t->trace_path.data + t->trace_path.len, &rec, sizeof(rec));
+    t->trace_path.len += sizeof(rec);
+    t->path_count++;
+}
+
+// Size(S_addr) | S_addr | Size(S_bin) | S_bin | Size(S_loop) | S_loop | Size(S_icall) | S_icall
+//   | Size(S_path) | S_path
+static uint32_t blob_size(oat_thread_ctx *t) {
+    return 5 * sizeof(uint32_t) + trace_bytes(t);
+}
+
+/* Copy bytes [off, off + size) of the blob without assembling it: the
+ * blob is just the ten segments below laid end to end. */
+static void read_blob(oat_thread_ctx *t, uint8_t *out, uint32_t off, uint32_t size) {
+    const struct { const void *p; uint32_t n; } seg[] = {
+        { &t->addr_count, sizeof(uint32_t) },
+        { t->trace_addr.data, t->trace_addr.len },
+        { &t->bin_bits, sizeof(uint32_t) },
+        { t->trace_bin.data, t->trace_bin.len },
+        { &t->loop_count, sizeof(uint32_t) },
+        { t->trace_loop.data, t->trace_loop.len },
+        { &t->icall_count, sizeof(uint32_t) },
+        { t->trace_icall.data, t->trace_icall.len },
+        { &t->path_count, sizeof(uint32_t) },
+        { t->trace_path.data, t->trace_path.len },
+    };
+
+    for (uint32_t i = 0; i < sizeof(seg) / sizeof(seg[0]) && size > 0; i++) {
+        if (off >= seg[i].n) {
+            off -= seg[i].n;
+            continue;
+        }
+        uint32_t take = seg[i].n - off;
+        if (take > size) take = size;
+        TEE_MemMove(out, (const uint8_t *)seg[i].p + off, take);
+        out += take;
+        size -= take;
+        off = 0;
+    }
+}
+
+/* --- Shadow Stack --- */
+
+static void chunk_digest(const oat_stack_chunk *c, uint8_t out[OAT_HASH_SIZE]) {
+    blake2s_state S;
+    blake2s_init(&S, OAT_HASH_SIZE);
+    blake2s_update(&S, c, sizeof(*c));
+    blake2s_final(&S, out);
+}
+
+/* Window full: move its oldest OAT_STACK_CHUNK entries to the heap */
+static TEE_Result stack_spill(oat_shadow_stack *s) {
+    if (s->spilled == s->spill_cap) {
+        // One more chunk, within what OAT_STACK_SPILL_LIMIT leaves of the
+        // session's. Only the small pointer table is ever reallocated.
+        if (sizeof(oat_stack_chunk) > OAT_STACK_SPILL_LIMIT - s->heap->spill) {
+            EMSG("Shadow stack limit reached (%u bytes spilled by this thread, %u by the session)",
+                 s->spilled * (uint32_t)sizeof(oat_stack_chunk), s->heap->spill);
+            return TEE_ERROR_OVERFLOW;
+        }
+        if (s->spill_cap == s->spill_slots) {
+            uint32_t slots = s->spill_slots ? s->spill_slots * 2 : 16;
+            oat_stack_chunk **spill = TEE_Realloc(s->spill, slots * sizeof(*spill));
+            if (!spill) return TEE_ERROR_OUT_OF_MEMORY;
+            s->spill = spill;
+            s->spill_slots = slots;
+        }
+        oat_stack_chunk *chunk = TEE_Malloc(sizeof(oat_stack_chunk), TEE_MALLOC_FILL_ZERO);
+        if (!chunk) return TEE_ERROR_OUT_OF_MEMORY;
+        s->spill[s->spill_cap++] = chunk;
+        s->heap->spill += sizeof(oat_stack_chunk);
+    }
+
+    oat_stack_chunk *c = s->spill[s->spilled++];
+    TEE_MemMove(c->prev, s->chain, OAT_HASH_SIZE);
+    TEE_MemMove(c->frames, s->frames, sizeof(c->frames));
+    chunk_digest(c, s->chain);
+
+    s->ptr -= OAT_STACK_CHUNK;
+    TEE_MemMove(s->frames, s->frames + OAT_STACK_CHUNK, s->ptr * sizeof(oat_frame));
+    return TEE_SUCCESS;
+}
+
+/* Window empty: bring the newest spilled chunk back, if it is intact */
+static TEE_Result stack_refill(oat_shadow_stack *s) {
+    oat_stack_chunk *c = s->spill[s->spilled - 1];
+    uint8_t digest[OAT_HASH_SIZE];
+    chunk_digest(c, digest);
+    if (TEE_MemCompare(digest, s->chain, OAT_HASH_SIZE) != 0) {
+        EMSG("SECURITY ALERT: shadow stack spill area modified");
+        return TEE_ERROR_SECURITY;
     }
+
+    TEE_MemMove(s->frames, c->frames, sizeof(c->frames));
+    TEE_MemMove(s->chain, c->prev, OAT_HASH_SIZE);
+    s->ptr = OAT_STACK_CHUNK;
+    s->spilled--;
+    return TEE_SUCCESS;
+}
+
+static TEE_Result stack_push(oat_shadow_stack *s, uint16_t id) {
+    if (s->ptr > 0) {
+        oat_frame *top = &s->frames[s->ptr - 1];
+        if (top->id == id && top->count < UINT16_MAX) {
+            top->count++;
+            return TEE_SUCCESS;
+        }
+    }
+    if (s->ptr == OAT_STACK_WINDOW) {
+        TEE_Result res = stack_spill(s);
+        if (res != TEE_SUCCESS) return res;
+    }
+    s->frames[s->ptr].id = id;
+    s->frames[s->ptr].count = 1;
+    s->ptr++;
+    return TEE_SUCCESS;
+}
+
+static TEE_Result stack_pop(oat_shadow_stack *s, uint16_t *id) {
+    if (s->ptr == 0 && s->spilled > 0) {
+        TEE_Result res = stack_refill(s);
+        if (res != TEE_SUCCESS) return res;
+    }
+    if (s->ptr == 0) return TEE_ERROR_SECURITY;
+
+    oat_frame *top = &s->frames[s->ptr - 1];
+    *id = top->id;
+    if (--top->count == 0) s->ptr--;
+    return TEE_SUCCESS;
+}
+
+// Frames the thread never returned from (pthread_exit); spill memory is kept
+static void stack_reset(oat_shadow_stack *s) {
+    s->ptr = 0;
+    s->spilled = 0;
+    TEE_MemFill(s->chain, 0, OAT_HASH_SIZE);
+}
+
+/* --- Event Handlers (shared by single-event commands and batches) --- */
+
+static void handle_branch(oat_thread_ctx *t, uint8_t bit) {
+    // Same byte the host sends with CMD_HASH_UPDATE
+    char decision = bit ? '1' : '0';
+    update_running_hash(t, &decision, 1);
+    append_branch_bit(t, bit);
+}
+
+/* Up to 32 decisions packed by the inline branch buffer. Hashed as the
+ * same '0'/'1' bytes as one EVT_BRANCH each, in a single update. */
+static TEE_Result handle_branch_bits(oat_thread_ctx *t, uint32_t bits, uint32_t count) {
+    char decisions[32];
+    if (count == 0 || count > 32) return TEE_ERROR_BAD_PARAMETERS;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t bit = (bits >> i) & 1;
+        decisions[i] = bit ? '1' : '0';
+        append_branch_bit(t, bit);
+    }
+    update_running_hash(t, decisions, count);
+    return TEE_SUCCESS;
+}
+
+/* Function IDs are the pass's dense 16-bit IDs; anything wider cannot
+ * belong to instrumented code. Stack events hash the 2-byte ID. */
+static TEE_Result handle_stack_push(oat_thread_ctx *t, uint32_t val) {
+    if (val > UINT16_MAX) return TEE_ERROR_BAD_PARAMETERS;
+
+    uint16_t id = (uint16_t)val;
+    TEE_Result res = stack_push(t->stack, id);
+    if (res != TEE_SUCCESS) return res;
+    update_running_hash(t, &id, sizeof(uint16_t));
+    return TEE_SUCCESS;
+}
+
+static TEE_Result handle_stack_pop(oat_thread_ctx *t, uint32_t val) {
+    uint16_t expected;
+    TEE_Result res = stack_pop(t->stack, &expected);
+    if (res != TEE_SUCCESS) return res;
+
+    if (expected != val) {
+        EMSG("SECURITY ALERT: ROP ATTACK! Exp: %u, Got: %u", expected, val);
+        return TEE_ERROR_SECURITY;
+    }
+    update_running_hash(t, &expected, sizeof(uint16_t));
+
+    // Per paper design: returns are captured in the hash only,
+    // NOT in the trace (they happen too frequently and overflow the buffer).
+    return TEE_SUCCESS;
+}
+
+static TEE_Result handle_indirect(oat_thread_ctx *t, uint64_t addr_target) {
+    update_running_hash(t, &addr_target, sizeof(uint64_t));
+
+    // Log the target address
+    append_indirect_addr(t, addr_target);
+    return TEE_SUCCESS;
+}
+
+/* Indirect call from a site the pass tabulated: the target's index in that
+ * site's table. One byte in the hash and the blob, and the same on every
+ * load address. A target outside the table is a control-flow violation
+ * and is refused right here rather than left for the verifier. */
+static TEE_Result handle_indirect_idx(oat_thread_ctx *t, uint32_t site, uint32_t idx) {
+    if (idx >= OAT_ICALL_UNLISTED) {
+        EMSG("SECURITY ALERT: CFI VIOLATION! Indirect call at site %u leaves its target table", site);
+        return TEE_ERROR_SECURITY;
+    }
+
+    uint8_t b = (uint8_t)idx;
+    update_running_hash(t, &b, 1);
+    append_icall_idx(t, b);
+    return TEE_SUCCESS;
+}
+
+/* A whole compressed loop in one event. The 'L' prefix keeps it from
+ * hashing like a run of stack events. */
+static void handle_loop(oat_thread_ctx *t, uint32_t site, uint32_t trips) {
+    uint8_t rec[9];
+    rec[0] = 'L';
+    TEE_MemMove(&rec[1], &site, sizeof(uint32_t));
+    TEE_MemMove(&rec[5], &trips, sizeof(uint32_t));
+    update_running_hash(t, rec, sizeof(rec));
+    append_loop(t, site, trips);
+}
+
+/* One acyclic path of a numbered function: the decisions along it are
+ * implied by the path ID. 'P' keeps it apart from loop records. */
+static void handle_path(oat_thread_ctx *t, uint32_t site, uint32_t path) {
+    uint8_t rec[9];
+    rec[0] = 'P';
+    TEE_MemMove(&rec[1], &site, sizeof(uint32_t));
+    TEE_MemMove(&rec[5], &path, sizeof(uint32_t));
+    update_running_hash(t, rec, sizeof(rec));
+    append_path(t, site, path);
+}
+
+/* --- Threads and Operations --- */
+
+/* Operation by ID. Op 0 always exists (events before its first
+ * CMD_HASH_INIT are checked but not measured); a pooled op must have been
+ * started and not yet released. */
+static TEE_Result op_get(oat_session_ctx *ctx, uint32_t id, oat_op_ctx **op) {
+    if (id >= OAT_MAX_OPS) return TEE_ERROR_BAD_PARAMETERS;
+    if (id != 0 && !ctx->ops[id]->is_crypto_initialized) return TEE_ERROR_BAD_STATE;
+    *op = ctx->ops[id];
+    return TEE_SUCCESS;
+}
+
+/* Operation named by a VALUE_INPUT params[2].value.b and the ID in
+ * value.a (op 0, ID 0 for callers that do not send one) */
+static TEE_Result op_param(oat_session_ctx *ctx, uint32_t param_types, TEE_Param params[4],
+                           oat_op_ctx **op, uint32_t *a) {
+    uint32_t id = 0;
+    *a = 0;
+    if (TEE_PARAM_TYPE_GET(param_types, 2) == TEE_PARAM_TYPE_VALUE_INPUT) {
+        *a = params[2].value.a;
+        id = params[2].value.b;
+    }
+    return op_get(ctx, id, op);
+}
+
+/* The stream CMD_GET_LOG reads: by index in start order, or with
+ * OAT_LOG_THREAD the current one of a thread (an empty one if it has
+ * none in this operation) */
+static TEE_Result log_stream(oat_session_ctx *ctx, oat_op_ctx *op, uint32_t a,
+                             oat_thread_ctx **t) {
+    if (a & OAT_LOG_THREAD) {
+        uint32_t tid = a & ~OAT_LOG_THREAD;
+        if (tid >= OAT_MAX_THREADS) return TEE_ERROR_BAD_PARAMETERS;
+        *t = op->live[tid] ? op->streams[op->live[tid] - 1] : &ctx->unmeasured;
+        return TEE_SUCCESS;
+    }
+    if (a >= op->n_streams) return TEE_ERROR_ITEM_NOT_FOUND;
+    *t = op->streams[a];
+    return TEE_SUCCESS;
+}
+
+/* Take a free pooled operation (IDs 1 .. OAT_MAX_OPS-1) */
+static TEE_Result op_alloc(oat_session_ctx *ctx, uint32_t *id) {
+    for (uint32_t i = 1; i < OAT_MAX_OPS; i++) {
+        if (ctx->ops[i]->is_crypto_initialized) continue;
+        *id = i;
+        return TEE_SUCCESS;
+    }
+    EMSG("All %u operation contexts in use", OAT_MAX_OPS - 1);
+    return TEE_ERROR_OUT_OF_MEMORY;
+}
+
+/* Digest handles and trace capacity stay for the next operation that
+ * gets this context; they are freed with the session. */
+static void op_release(oat_op_ctx *op) {
+    for (uint32_t i = 0; i < op->n_streams; i++) {
+        op->streams[i]->is_measuring = false;
+        op->streams[i]->finished = false;
+    }
+    op->n_streams = 0;
+    TEE_MemFill(op->live, 0, sizeof(op->live));
+    op->is_crypto_initialized = false;
+    op->sealed = false;
+}
+
+/* Allocate, for every operation context, the digest handles of the first
+ * `threads` streams and `cap` bytes of each of their trace sections, plus
+ * the handle that combines thread digests. Operations started afterwards
+ * (and all that stay within these sizes) run without heap allocation.
+ * The sections together take at most half of OAT_TRACE_LIMIT, so the rest
+ * is left for whichever traces turn out to be long. */
+static TEE_Result op_prepare(oat_session_ctx *ctx, uint32_t alg, uint32_t threads, uint32_t cap) {
+    if (threads == 0 || threads > OAT_MAX_THREADS) return TEE_ERROR_BAD_PARAMETERS;
+    uint32_t share = OAT_TRACE_LIMIT / 2 / (OAT_MAX_OPS * threads * 5);
+    if (cap > share) cap = share;
+
+    for (uint32_t o = 0; o < OAT_MAX_OPS; o++) {
+        oat_op_ctx *op = ctx->ops[o];
+        TEE_Result res = oat_hash_init(&op->combine, alg);
+        if (res != TEE_SUCCESS) return res;
+        for (uint32_t i = 0; i < threads; i++) {
+            oat_thread_ctx *t;
+            res = stream_slot(op, &ctx->heap, i, &t);
+            if (res != TEE_SUCCESS) return res;
+            // Not measuring: the handle is only allocated (or reset) here
+            if (!t->is_measuring) res = oat_hash_init(&t->hash, alg);
+            if (res == TEE_SUCCESS) res = trace_grow(&ctx->heap, &t->trace_bin, cap);
+            if (res == TEE_SUCCESS) res = trace_grow(&ctx->heap, &t->trace_addr, cap);
+            if (res == TEE_SUCCESS) res = trace_grow(&ctx->heap, &t->trace_loop, cap);
+            if (res == TEE_SUCCESS) res = trace_grow(&ctx->heap, &t->trace_icall, cap);
+            if (res == TEE_SUCCESS) res = trace_grow(&ctx->heap, &t->trace_path, cap);
+            if (res != TEE_SUCCESS) return res;
+        }
+    }
+    return TEE_SUCCESS;
+}
+
+/* Move a finished operation into a free pooled context so its ID can be
+ * started again at once. Only the two ID entries are swapped: digests,
+ * trace buffers and capacity stay with their context, and ID `id` gets
+ * the free one, stopped (not measuring). The sealed context only answers
+ * CMD_HASH_FINAL, CMD_GET_LOG and CMD_HASH_RELEASE, so an operation
+ * other threads are still on is copied by op_snapshot instead. */
+static TEE_Result op_seal(oat_session_ctx *ctx, uint32_t id, uint32_t *slot) {
+    oat_op_ctx *op;
+    TEE_Result res = op_get(ctx, id, &op);
+    if (res != TEE_SUCCESS) return res;
+    if (!op->is_crypto_initialized || op->sealed) return TEE_ERROR_BAD_STATE;
+
+    res = op_alloc(ctx, slot);
+    if (res != TEE_SUCCESS) return res;
+
+    ctx->ops[id] = ctx->ops[*slot];
+    ctx->ops[*slot] = op;
+    op->sealed = true;
+    return TEE_SUCCESS;
+}
+
+static TEE_Result trace_copy(oat_heap_use *heap, oat_trace_buf *dst, const oat_trace_buf *src) {
+    TEE_Result res = trace_grow(heap, dst, src->len);
+    if (res != TEE_SUCCESS) return res;
+    if (src->len) TEE_MemMove(dst->data, src->data, src->len);
+    dst->len = src->len;
+    return TEE_SUCCESS;
+}
+
+/* A stream as it is now: digest state (or the finished digest), counts and
+ * trace. Trace capacity counts against OAT_TRACE_LIMIT like any other. */
+static TEE_Result stream_copy(oat_heap_use *heap, oat_thread_ctx *dst, const oat_thread_ctx *src) {
+    TEE_Result res = src->finished ? TEE_SUCCESS : oat_hash_copy(&dst->hash, &src->hash);
+    if (res == TEE_SUCCESS) res = trace_copy(heap, &dst->trace_bin, &src->trace_bin);
+    if (res == TEE_SUCCESS) res = trace_copy(heap, &dst->trace_addr, &src->trace_addr);
+    if (res == TEE_SUCCESS) res = trace_copy(heap, &dst->trace_loop, &src->trace_loop);
+    if (res == TEE_SUCCESS) res = trace_copy(heap, &dst->trace_icall, &src->trace_icall);
+    if (res == TEE_SUCCESS) res = trace_copy(heap, &dst->trace_path, &src->trace_path);
+    if (res != TEE_SUCCESS) return res;
+
+    dst->stack = src->stack;
+    dst->is_measuring = src->is_measuring;
+    dst->finished = src->finished;
+    TEE_MemMove(dst->digest, src->digest, OAT_HASH_SIZE);
+    dst->bin_bits = src->bin_bits;
+    dst->addr_count = src->addr_count;
+    dst->loop_count = src->loop_count;
+    dst->icall_count = src->icall_count;
+    dst->path_count = src->path_count;
+    dst->trace_lost = src->trace_lost;
+    return TEE_SUCCESS;
+}
+
+/* CMD_HASH_SEAL with OAT_SEAL_COPY: a sealed copy of the operation in a
+ * free pooled context, while the operation itself keeps measuring for
+ * the threads still on it */
+static TEE_Result op_snapshot(oat_session_ctx *ctx, uint32_t id, uint32_t *slot) {
+    oat_op_ctx *op;
+    TEE_Result res = op_get(ctx, id, &op);
+    if (res != TEE_SUCCESS) return res;
+    if (!op->is_crypto_initialized || op->sealed) return TEE_ERROR_BAD_STATE;
+
+    res = op_alloc(ctx, slot);
+    if (res != TEE_SUCCESS) return res;
+
+    oat_op_ctx *snap = ctx->ops[*slot];
+    for (uint32_t i = 0; i < op->n_streams; i++) {
+        oat_thread_ctx *t;
+        res = stream_slot(snap, &ctx->heap, i, &t);
+        if (res == TEE_SUCCESS) res = stream_copy(&ctx->heap, t, op->streams[i]);
+        if (res != TEE_SUCCESS) {
+            snap->n_streams = i + 1;
+            op_release(snap);
+            return res;
+        }
+    }
+    snap->n_streams = op->n_streams;
+    TEE_MemMove(snap->live, op->live, sizeof(snap->live));
+    snap->alg = op->alg;
+    snap->is_crypto_initialized = true;
+    snap->sealed = true;
+    return TEE_SUCCESS;
+}
+
+/* A stream's digest: kept from its thread's exit, or taken now */
+static TEE_Result stream_digest(oat_thread_ctx *t, uint8_t *out, uint32_t *out_size) {
+    if (!t->finished) return oat_hash_final(&t->hash, out, out_size);
+    TEE_MemMove(out, t->digest, OAT_HASH_SIZE);
+    *out_size = OAT_HASH_SIZE;
+    return TEE_SUCCESS;
+}
+
+/* With one stream measured the proof is its digest, exactly as before
+ * threads existed. Otherwise it is the hash of
+ *   alg | "OATT" | uint32 count | digest[count]
+ * over every stream, finished or live, with the digests sorted, so the
+ * proof depends on what each thread did but not on which ID it happened
+ * to get or whether an ID was reused. */
+static TEE_Result final_proof(oat_op_ctx *op, void *out, uint32_t *out_size) {
+    uint8_t digests[OAT_MAX_STREAMS][OAT_HASH_SIZE];
+    uint32_t count, size;
+    TEE_Result res;
+
+    if (*out_size < OAT_HASH_SIZE) {
+        *out_size = OAT_HASH_SIZE;
+        return TEE_ERROR_SHORT_BUFFER;
+    }
+    if (op->n_streams == 1) return stream_digest(op->streams[0], out, out_size);
+
+    for (count = 0; count < op->n_streams; count++) {
+        size = OAT_HASH_SIZE;
+        res = stream_digest(op->streams[count], digests[count], &size);
+        if (res != TEE_SUCCESS) return res;
+
+        // Insertion sort, at most OAT_MAX_STREAMS entries
+        for (uint32_t j = count; j > 0 && TEE_MemCompare(digests[j - 1], digests[j], OAT_HASH_SIZE) > 0; j--) {
+            uint8_t tmp[OAT_HASH_SIZE];
+            TEE_MemMove(tmp, digests[j], OAT_HASH_SIZE);
+            TEE_MemMove(digests[j], digests[j - 1], OAT_HASH_SIZE);
+            TEE_MemMove(digests[j - 1], tmp, OAT_HASH_SIZE);
+        }
+    }
+
+    oat_hash_ctx *h = &op->combine;
+    res = oat_hash_init(h, op->alg);
+    if (res != TEE_SUCCESS) return res;
+    oat_hash_update(h, &op->alg, sizeof(uint32_t));
+    oat_hash_update(h, "OATT", 4);
+    oat_hash_update(h, &count, sizeof(uint32_t));
+    oat_hash_update(h, digests, count * OAT_HASH_SIZE);
+    return oat_hash_final(h, out, out_size);
+}
+
+/* --- Critical Variable Integrity --- */
+
+/* Linear probing from a multiplicative hash. Slots are never emptied, so
+ * a key is found before the first never-used slot or not at all. */
+static oat_cvi_slot *cvi_find(oat_session_ctx *ctx, uint32_t key, bool insert) {
+    uint32_t h = (key * 2654435761u) >> 16;
+    for (uint32_t i = 0; i < OAT_CVI_SLOTS; i++) {
+        oat_cvi_slot *s = &ctx->cvi_slots[(h + i) & (OAT_CVI_SLOTS - 1)];
+        if (s->epoch != 0 && s->key != key) continue;
+        if (s->epoch == 0 && !insert) return NULL;
+        s->key = key;
+        return s;
+    }
+    return NULL;
+}
+
+static void cvi_hash(oat_thread_ctx *t, char kind, uint32_t key) {
+    uint8_t rec[3] = { (uint8_t)kind, (uint8_t)key, (uint8_t)(key >> 8) };
+    update_running_hash(t, rec, sizeof(rec));
+}
+
+static void cvi_store(oat_session_ctx *ctx, uint32_t key, uint32_t value) {
+    uint32_t var = key & 0xFFFF;
+    oat_cvi_slot *s = cvi_find(ctx, key, true);
+    if (!s) {
+        // Untracked from here on: its uses are adopted, never flagged
+        if (!ctx->cvi_full_reported) EMSG("CVI shadow table full, var %u not tracked", var);
+        ctx->cvi_full_reported = true;
+        return;
+    }
+    s->value = value;
+    s->epoch = ctx->cvi_epoch[var];
+}
+
+/* Variables are process-wide: one shadow table for all threads, while the
+ * def/use records go into the accessing thread's measurement */
+static TEE_Result handle_cvi_def(oat_session_ctx *ctx, oat_thread_ctx *t,
+                                 uint32_t key, uint32_t value) {
+    if ((key & 0xFFFF) >= OAT_CVI_MAX_VARS) return TEE_ERROR_BAD_PARAMETERS;
+    cvi_hash(t, 'D', key);
+    cvi_store(ctx, key, value);
+    return TEE_SUCCESS;
+}
+
+static TEE_Result handle_cvi_use(oat_session_ctx *ctx, oat_thread_ctx *t,
+                                 uint32_t key, uint32_t value) {
+    uint32_t var = key & 0xFFFF;
+    if (var >= OAT_CVI_MAX_VARS) return TEE_ERROR_BAD_PARAMETERS;
+    cvi_hash(t, 'U', key);
+
+    oat_cvi_slot *s = cvi_find(ctx, key, false);
+    if (s && s->epoch == ctx->cvi_epoch[var]) {
+        if (s->value != value) {
+            EMSG("SECURITY ALERT: DATA ATTACK! var %u+%u: attested 0x%08x, loaded 0x%08x",
+                 var, key >> 16, s->value, value);
+            return TEE_ERROR_SECURITY;
+        }
+        return TEE_SUCCESS;
+    }
+    cvi_store(ctx, key, value);
+    return TEE_SUCCESS;
+}
+
+static TEE_Result handle_cvi_forget(oat_session_ctx *ctx, uint32_t var) {
+    if (var >= OAT_CVI_MAX_VARS) return TEE_ERROR_BAD_PARAMETERS;
+    ctx->cvi_epoch[var]++;
+    return TEE_SUCCESS;
+}
+
+/* Consume a whole buffer of struct oat_event records in one invocation.
+ * Records live in normal-world shared memory, so each one is copied into
+ * secure memory before it is looked at. Processing stops at the first
+ * violation; its index and tag are reported back in params[1]. The
+ * sending thread and the operation it measures into are in params[2]
+ * (thread 0, op 0 without it).
+ */
+static TEE_Result handle_event_batch(oat_session_ctx *ctx, uint32_t param_types,
+                                     TEE_Param params[4]) {
+    if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_INPUT)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (params[0].memref.size % sizeof(struct oat_event) != 0)
+        return TEE_ERROR_BAD_PARAMETERS;
+
+    oat_op_ctx *op;
+    oat_thread_ctx *t = NULL;
+    uint32_t tid;
+    TEE_Result res = op_param(ctx, param_types, params, &op, &tid);
+    if (res != TEE_SUCCESS) return res;
+    if (tid >= OAT_MAX_THREADS) return TEE_ERROR_BAD_PARAMETERS;
+    if (op->sealed) return TEE_ERROR_BAD_STATE;
+
+    bool report = TEE_PARAM_TYPE_GET(param_types, 1) == TEE_PARAM_TYPE_VALUE_OUTPUT;
+    const struct oat_event *events = params[0].memref.buffer;
+    uint32_t count = params[0].memref.size / sizeof(struct oat_event);
+    struct oat_event ev;
+
+    for (uint32_t i = 0; i < count; i++) {
+        TEE_MemMove(&ev, &events[i], sizeof(ev));
+        // A thread that only exits has taken no part in the operation
+        res = ev.tag == EVT_THREAD_EXIT || t ? TEE_SUCCESS : thread_stream(ctx, op, tid, &t);
+        if (res != TEE_SUCCESS) return res;
+
+        switch (ev.tag) {
+            case EVT_BRANCH:
+                handle_branch(t, ev.a != 0);
+                break;
+            case EVT_BRANCH_BITS:
+                res = handle_branch_bits(t, ev.a, ev.b);
+                break;
+            case EVT_STACK_PUSH:
+                // A frame that cannot be recorded leaves its return unchecked
+                res = handle_stack_push(t, ev.a);
+                break;
+            case EVT_STACK_POP:
+                res = handle_stack_pop(t, ev.a);
+                break;
+            case EVT_INDIRECT_CALL:
+                res = handle_indirect(t, ev.a | ((uint64_t)ev.b << 32));
+                break;
+            case EVT_LOOP:
+                handle_loop(t, ev.a, ev.b);
+                break;
+            case EVT_PATH:
+                handle_path(t, ev.a, ev.b);
+                break;
+            case EVT_INDIRECT_IDX:
+                res = handle_indirect_idx(t, ev.a, ev.b);
+                break;
+            case EVT_CVI_DEF:
+                res = handle_cvi_def(ctx, t, ev.a, ev.b);
+                break;
+            case EVT_CVI_USE:
+                res = handle_cvi_use(ctx, t, ev.a, ev.b);
+                break;
+            case EVT_CVI_FORGET:
+                res = handle_cvi_forget(ctx, ev.a);
+                break;
+            case EVT_THREAD_EXIT:
+                // Its streams end in every operation, whichever it was on
+                for (uint32_t o = 0; o < OAT_MAX_OPS && res == TEE_SUCCESS; o++)
+                    if (ctx->ops[o]->is_crypto_initialized && !ctx->ops[o]->sealed)
+                        res = thread_end(ctx->ops[o], tid);
+                stack_reset(&ctx->stacks[tid]);
+                t = NULL;
+                break;
+            default:
+                res = TEE_ERROR_BAD_PARAMETERS;
+                break;
+        }
+
+        if (res != TEE_SUCCESS) {
+            if (report) {
+                params[1].value.a = i;
+                params[1].value.b = ev.tag;
+            }
+            return res;
+        }
+    }
+
+    if (report) params[1].value.a = count;
+    return TEE_SUCCESS;
 }
 
 /* --- Command Handler --- */
@@ -85,61 +1157,71 @@ static void append_log(oat_session_ctx *ctx, uint8_t tag, void* data, uint32_t s
 TEE_Result TA_InvokeCommandEntryPoint(void *sess_ctx, uint32_t cmd_id,
                                       uint32_t param_types, TEE_Param params[4]) {
     oat_session_ctx *ctx = (oat_session_ctx *)sess_ctx;
-    uint32_t val;
+    // Single-event commands: thread 0 of op 0, if it is measuring
+    oat_thread_ctx *main_thread = &ctx->unmeasured;
+    if (ctx->ops[0]->live[0]) main_thread = ctx->ops[0]->streams[ctx->ops[0]->live[0] - 1];
+    else ctx->unmeasured.stack = &ctx->stacks[0];
+    oat_op_ctx *op;
+    uint32_t op_id, alg, tid;
     uint64_t addr_target;
     char *decision_char;
 
     switch (cmd_id) {
         case CMD_HASH_INIT:
-            return init_session(ctx);
+            // Optional value param selects the backend (default SHA-256)
+            alg = OAT_HASH_SHA256;
+            if (TEE_PARAM_TYPE_GET(param_types, 0) == TEE_PARAM_TYPE_VALUE_INPUT)
+                alg = params[0].value.a;
+            // Measured from here by the thread in params[2] (default 0)
+            tid = TEE_PARAM_TYPE_GET(param_types, 2) == TEE_PARAM_TYPE_VALUE_INPUT ? params[2].value.a : 0;
+            if (tid >= OAT_MAX_THREADS) return TEE_ERROR_BAD_PARAMETERS;
+            // Without params[1]: restart op 0. With it: start a new op
+            // from the pool and return its ID there.
+            if (TEE_PARAM_TYPE_GET(param_types, 1) != TEE_PARAM_TYPE_VALUE_OUTPUT)
+                return init_op(ctx, ctx->ops[0], alg, tid);
+            TEE_Result ires = op_alloc(ctx, &op_id);
+            if (ires != TEE_SUCCESS) return ires;
+            ires = init_op(ctx, ctx->ops[op_id], alg, tid);
+            if (ires != TEE_SUCCESS) return ires;
+            params[1].value.a = op_id;
+            return TEE_SUCCESS;
 
         // 1. BRANCH LOGGING
         case CMD_HASH_UPDATE: 
             if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_INPUT)
                 return TEE_ERROR_BAD_PARAMETERS;
-            if (!ctx->is_crypto_initialized) return TEE_ERROR_BAD_STATE;
+            if (!ctx->ops[0]->is_crypto_initialized) return TEE_ERROR_BAD_STATE;
             
             // Hash it
-            TEE_DigestUpdate(ctx->op_handle, params[0].memref.buffer, params[0].memref.size);
+            update_running_hash(main_thread, params[0].memref.buffer, params[0].memref.size);
             
-            // Log it
-       //     append_log(ctx, TAG_BRANCH, params[0].memref.buffer, params[0].memref.size);
+            // Log it ('1' taken / '0' not taken)
+            if (params[0].memref.size > 0)
+                append_branch_bit(main_thread, ((char *)params[0].memref.buffer)[0] != '0');
             return TEE_SUCCESS;
 
+        // Proof of the op in params[1] VALUE_INPUT (op 0 without it)
         case CMD_HASH_FINAL:
             if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_OUTPUT)
                 return TEE_ERROR_BAD_PARAMETERS;
+            op_id = TEE_PARAM_TYPE_GET(param_types, 1) == TEE_PARAM_TYPE_VALUE_INPUT ? params[1].value.a : 0;
+            TEE_Result fres = op_get(ctx, op_id, &op);
+            if (fres != TEE_SUCCESS) return fres;
+            if (!op->is_crypto_initialized) return TEE_ERROR_BAD_STATE;
             uint32_t out_size = params[0].memref.size;
-            return TEE_DigestDoFinal(ctx->op_handle, NULL, 0, params[0].memref.buffer, &out_size);
+            fres = final_proof(op, params[0].memref.buffer, &out_size);
+            params[0].memref.size = out_size;
+            return fres;
 
         // 2. SHADOW STACK PUSH (Not logged to file, only tracked in RAM)
         case CMD_STACK_PUSH:
             if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_VALUE_INPUT) return TEE_ERROR_BAD_PARAMETERS;
-            val = params[0].value.a;
-            if (ctx->stack_ptr >= MAX_STACK_DEPTH) return TEE_ERROR_OVERFLOW;
-            
-            ctx->shadow_stack[ctx->stack_ptr++] = val;
-            update_running_hash(ctx, &val, sizeof(uint32_t));
-            return TEE_SUCCESS;
+            return handle_stack_push(main_thread, params[0].value.a);
 
         // 3. SHADOW STACK POP (Logged!)
         case CMD_STACK_POP:
             if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_VALUE_INPUT) return TEE_ERROR_BAD_PARAMETERS;
-            val = params[0].value.a;
-            if (ctx->stack_ptr <= 0) return TEE_ERROR_SECURITY;
-            
-            ctx->stack_ptr--;
-            uint32_t expected = ctx->shadow_stack[ctx->stack_ptr];
-            if (expected != val) {
-                EMSG("SECURITY ALERT: ROP ATTACK! Exp: %u, Got: %u", expected, val);
-                return TEE_ERROR_SECURITY;
-            }
-            update_running_hash(ctx, &val, sizeof(uint32_t));
-            
-            // Per paper design: returns are captured in the hash only,
-            // NOT in the trace (they happen too frequently and overflow the buffer).
-            // append_log(ctx, TAG_STACK_POP, &val, sizeof(uint32_t));
-            return TEE_SUCCESS;
+            return handle_stack_pop(main_thread, params[0].value.a);
 
         // 4. INDIRECT JUMP (Logged!)
         case CMD_INDIRECT_CALL:
@@ -148,29 +1230,75 @@ TEE_Result TA_InvokeCommandEntryPoint(void *sess_ctx, uint32_t cmd_id,
 
             addr_target = params[0].value.a;
             addr_target |= ((uint64_t)params[0].value.b << 32);
+            return handle_indirect(main_thread, addr_target);
 
-            update_running_hash(ctx, &addr_target, sizeof(uint64_t));
-            
-            // Log the target address
-      //      append_log(ctx, TAG_INDIRECT, &addr_target, sizeof(uint64_t));
-            return TEE_SUCCESS;
-
-        // 5. GET LOG (Export to Host)
+        // 5. GET LOG (Export to Host), of the thread and op in params[2]
         case CMD_GET_LOG:
-             if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_OUTPUT)
+             // Paged: params[1] in = offset, out = bytes remaining / events lost
+             if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_MEMREF_OUTPUT ||
+                 TEE_PARAM_TYPE_GET(param_types, 1) != TEE_PARAM_TYPE_VALUE_INOUT)
                 return TEE_ERROR_BAD_PARAMETERS;
-             
-             uint32_t req_size = params[0].memref.size;
-             if (req_size < ctx->log_idx) {
-                 params[0].memref.size = ctx->log_idx; // Tell Host needed size
-                 return TEE_ERROR_SHORT_BUFFER;
-             }
-             
-             // Copy buffer to Host
-             TEE_MemMove(params[0].memref.buffer, ctx->execution_log, ctx->log_idx);
-             params[0].memref.size = ctx->log_idx; // Return actual size
+             oat_thread_ctx *t;
+             uint32_t which;
+             TEE_Result lres = op_param(ctx, param_types, params, &op, &which);
+             if (lres != TEE_SUCCESS) return lres;
+             // So the host exports exactly the streams there are
+             if (TEE_PARAM_TYPE_GET(param_types, 3) == TEE_PARAM_TYPE_VALUE_OUTPUT)
+                 params[3].value.a = op->n_streams;
+             lres = log_stream(ctx, op, which, &t);
+             if (lres != TEE_SUCCESS) return lres;
+
+             uint32_t log_size = blob_size(t);
+             uint32_t off = params[1].value.a;
+             if (off > log_size) return TEE_ERROR_BAD_PARAMETERS;
+             uint32_t page = log_size - off;
+             if (page > params[0].memref.size) page = params[0].memref.size;
+
+             read_blob(t, params[0].memref.buffer, off, page);
+             params[0].memref.size = page;
+             params[1].value.a = log_size - off - page;
+             params[1].value.b = t->trace_lost;
              return TEE_SUCCESS;
 
+        // 6. EVENT BATCH (many hooks, one world switch)
+        case CMD_EVENT_BATCH:
+            return handle_event_batch(ctx, param_types, params);
+
+        // 7. HASH BACKEND BENCHMARK (does not touch the session's measurement)
+        case CMD_HASH_BENCH:
+            if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_VALUE_INPUT ||
+                TEE_PARAM_TYPE_GET(param_types, 1) != TEE_PARAM_TYPE_VALUE_OUTPUT)
+                return TEE_ERROR_BAD_PARAMETERS;
+            return run_hash_bench(params[0].value.a, params[0].value.b, &params[1].value.a);
+
+        // 8. RELEASE a pooled operation once its proof and log are taken
+        case CMD_HASH_RELEASE:
+            if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_VALUE_INPUT)
+                return TEE_ERROR_BAD_PARAMETERS;
+            if (params[0].value.a == 0) return TEE_ERROR_BAD_PARAMETERS;
+            TEE_Result rres = op_get(ctx, params[0].value.a, &op);
+            if (rres != TEE_SUCCESS) return rres;
+            op_release(op);
+            return TEE_SUCCESS;
+
+        // 9. SEAL the op in params[0] into a pooled slot, returned in params[1]
+        case CMD_HASH_SEAL:
+            if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_VALUE_INPUT ||
+                TEE_PARAM_TYPE_GET(param_types, 1) != TEE_PARAM_TYPE_VALUE_OUTPUT)
+                return TEE_ERROR_BAD_PARAMETERS;
+            if (params[0].value.b & OAT_SEAL_COPY)
+                return op_snapshot(ctx, params[0].value.a, &params[1].value.a);
+            return op_seal(ctx, params[0].value.a, &params[1].value.a);
+
+        // 10. PREPARE every op context up front (backend, thread count, trace bytes)
+        case CMD_HASH_PREPARE:
+            if (TEE_PARAM_TYPE_GET(param_types, 0) != TEE_PARAM_TYPE_VALUE_INPUT)
+                return TEE_ERROR_BAD_PARAMETERS;
+            uint32_t cap = TRACE_MIN_CAP;
+            if (TEE_PARAM_TYPE_GET(param_types, 1) == TEE_PARAM_TYPE_VALUE_INPUT)
+                cap = params[1].value.a;
+            return op_prepare(ctx, params[0].value.a, params[0].value.b, cap);
+
         default:
             return TEE_ERROR_BAD_PARAMETERS;
     }
@@ -1,5 +1,17 @@
 global-incdirs-y += include
 srcs-y += oat_ta.c
+srcs-y += blake2s.c
+
+# Trace limit in bytes for the whole session (default 256 KB, see oat_ta.c)
+#cflags-y += -DOAT_TRACE_LIMIT=262144
+
+# Shadow stack spill limit in bytes for the whole session (default 128 KB,
+# see oat_ta.c). Growing a trace section briefly holds its old and new
+# buffers, so keep TA_DATA_SIZE (user_ta_header_defines.h) above
+#   trace limit * 3/2 + spill limit + ~100 KB of session, operation and
+#   stream contexts
+# with some headroom for allocator overhead.
+#cflags-y += -DOAT_STACK_SPILL_LIMIT=131072
 
 # To remove a certain compiler flag, add a line like this
 #cflags-template_ta.c-y += -Wno-strict-prototypes
@@ -19,8 +19,17 @@
 /* Provisioned stack size */
 #define TA_STACK_SIZE			(16 * 1024)
 
-/* Provisioned heap size for TEE_Malloc() and friends */
-#define TA_DATA_SIZE			(128 * 1024)
+/* Provisioned heap size for TEE_Malloc() and friends: session context
+ * (about 22 KB) + operation contexts (under 700 bytes each) + stream
+ * contexts (under 600 bytes each, at most OAT_MAX_OPS x OAT_MAX_STREAMS =
+ * 128 of them, about 73 KB) + traces, up to OAT_TRACE_LIMIT (256 KB) for
+ * the session + shadow stack spill, up to OAT_STACK_SPILL_LIMIT (128 KB)
+ * for the session, in 160-byte chunks. Growing a trace section with
+ * TEE_Realloc briefly needs up to half the trace limit more
+ * (OAT_TRACE_PEAK): about 610 KB at the peak, plus headroom for
+ * allocator overhead and fragmentation. Raise it along with either
+ * limit. */
+#define TA_DATA_SIZE			(768 * 1024)
 
 /* Extra properties (give a version id and a string name) */
 #define TA_CURRENT_TA_EXT_PROPERTIES \
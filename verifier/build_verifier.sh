@@ -0,0 +1,28 @@
+#!/bin/bash
+set -e
+
+# Native build of the offline verifier (runs on the verifier host, not the
+# RPi3). Reuses the TA's BLAKE2s and the software TEE's SHA-256 so the
+# digests are bit-for-bit the ones the TA computes.
+
+# --- CONFIGURATION ---
+CC="${CC:-cc}"
+CXX="${CXX:-c++}"
+LLVM_CONFIG="${LLVM_CONFIG:-llvm-config}"
+TA_DIR="../ta/oat/ta"
+SOFT_TEE="../host/soft_tee"
+
+# --- BUILD STEPS ---
+
+echo "[1/2] Building hash backends..."
+$CC -O2 -c $TA_DIR/blake2s.c -o blake2s.o -I$TA_DIR/include
+$CC -O2 -c $SOFT_TEE/sha256.c -o sha256.o -I$SOFT_TEE
+
+echo "[2/2] Building oat_verify..."
+$CXX -O2 oat_verify.cpp blake2s.o sha256.o -o oat_verify \
+    -I$TA_DIR/include -I$SOFT_TEE \
+    $($LLVM_CONFIG --cxxflags) \
+    $($LLVM_CONFIG --ldflags --libs core irreader support --system-libs) -pthread
+
+echo "DONE! Usage:"
+echo "  ./oat_verify -p <proof> syringe_instrumented.ll syringe.bin"
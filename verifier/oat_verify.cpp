@@ -0,0 +1,1347 @@
+/* verifier/oat_verify.cpp */
+// Offline OAT verifier: replays one operation's measurement against the
+// instrumented program and recomputes the proof the TA must have produced.
+//
+// The instrumented module (output of oat-pass, .ll or .bc) is decoded once
+// into per-block action lists (the __oat_* hooks and calls, in order).
+// Replay then walks those blocks: every hook appends exactly the bytes the
+// TA hashes for it, branch hooks must agree with S_bin, indirect-call hooks
+// take the next S_addr entry (or the next S_icall index into the site's
+// .oat_icall table) and compressed loops the next S_loop record.
+// Functions with numbered paths keep their path register like the
+// program does: a numbered branch follows the edge that leads to the
+// next S_path record, and each path end must match that record.
+// Where the trace alone does not pick a successor (switch, ambiguous
+// indirect target, a loop exit that also matches the next record) the
+// replay takes the most likely choice and backtracks on divergence.
+//
+//   oat_verify [-p <proof hex>] [-a sha256|blake2s] [-s <func>]
+//              [-m <symbols>] <instrumented.ll|.bc> <blob>
+//
+// Batch mode (-b) decodes the module once and verifies many blobs on a
+// work-stealing thread pool, streaming one CSV row per blob.
+//
+// Exit status: 0 accept, 1 reject, 2 usage or input error.
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+extern "C" {
+#include "blake2s.h"
+#include "sha256.h"
+}
+
+using namespace llvm;
+
+namespace {
+
+// Must match oat_ta.h
+constexpr uint32_t OAT_HASH_SHA256 = 0;
+constexpr uint32_t OAT_HASH_BLAKE2S = 1;
+constexpr uint32_t OAT_HASH_SIZE = 32;
+
+// Replay limits: the trace bounds any honest path, these only stop
+// pathological searches (uninstrumented cycles, deep switch nests)
+constexpr uint64_t MAX_STEPS = 200000000;
+constexpr uint64_t MAX_BACKTRACKS = 1000000;
+constexpr size_t MAX_DEPTH = 100000;
+
+const char *const PROOF_DIFFERS = "trace consumed but proof differs";
+
+/* --- Measurement blob (CMD_GET_LOG) --- */
+
+struct LoopRecord {
+  uint32_t Site;
+  uint32_t Trips;
+};
+
+struct PathRecord {
+  uint32_t Site;
+  uint32_t Path;
+};
+
+struct Trace {
+  std::vector<uint64_t> Addrs;
+  std::vector<uint8_t> Bin;
+  uint32_t Bits = 0;
+  std::vector<LoopRecord> Loops;
+  std::vector<uint8_t> ICalls; // S_icall: per-site table indices
+  std::vector<PathRecord> Paths;
+
+  bool bit(uint32_t I) const { return (Bin[I / 8] >> (I % 8)) & 1; }
+};
+
+static uint32_t rd32(const uint8_t *P) {
+  return P[0] | (P[1] << 8) | (P[2] << 16) | ((uint32_t)P[3] << 24);
+}
+
+static bool parseBlob(const std::vector<uint8_t> &B, Trace &T, std::string &Err) {
+  size_t Off = 0;
+  auto need = [&](size_t N) {
+    if (B.size() - Off >= N) return true;
+    Err = "truncated blob at offset " + std::to_string(Off);
+    return false;
+  };
+
+  if (!need(4)) return false;
+  uint32_t NAddr = rd32(&B[Off]);
+  Off += 4;
+  if (!need((size_t)NAddr * 8)) return false;
+  for (uint32_t I = 0; I < NAddr; I++, Off += 8)
+    T.Addrs.push_back(rd32(&B[Off]) | ((uint64_t)rd32(&B[Off + 4]) << 32));
+
+  if (!need(4)) return false;
+  T.Bits = rd32(&B[Off]);
+  Off += 4;
+  if (!need((T.Bits + 7) / 8)) return false;
+  T.Bin.assign(B.begin() + Off, B.begin() + Off + (T.Bits + 7) / 8);
+  Off += (T.Bits + 7) / 8;
+
+  // Blobs from before loop compression end here
+  if (Off == B.size()) return true;
+  if (!need(4)) return false;
+  uint32_t NLoop = rd32(&B[Off]);
+  Off += 4;
+  if (!need((size_t)NLoop * 8)) return false;
+  for (uint32_t I = 0; I < NLoop; I++, Off += 8)
+    T.Loops.push_back({rd32(&B[Off]), rd32(&B[Off + 4])});
+
+  // ... and from before indirect-call tables here
+  if (Off == B.size()) return true;
+  if (!need(4)) return false;
+  uint32_t NICall = rd32(&B[Off]);
+  Off += 4;
+  if (!need(NICall)) return false;
+  T.ICalls.assign(B.begin() + Off, B.begin() + Off + NICall);
+  Off += NICall;
+
+  // ... and from before path numbering here
+  if (Off == B.size()) return true;
+  if (!need(4)) return false;
+  uint32_t NPath = rd32(&B[Off]);
+  Off += 4;
+  if (!need((size_t)NPath * 8)) return false;
+  for (uint32_t I = 0; I < NPath; I++, Off += 8)
+    T.Paths.push_back({rd32(&B[Off]), rd32(&B[Off + 4])});
+  return true;
+}
+
+/* --- Decoded program --- */
+
+enum ActionKind : uint8_t {
+  ACT_LOG,       // __oat_log(c), or an inline !oat.bit update
+  ACT_ENTER,     // __oat_func_enter(id)
+  ACT_EXIT,      // __oat_func_exit(id) / __oat_func_exit_sync(id)
+  ACT_LOG_LOOP,  // __oat_log_loop(site, trips)
+  ACT_LOG_ICALL, // __oat_log_indirect(addr)
+  ACT_LOG_IDX,   // __oat_log_indirect_idx(site, idx)
+  ACT_CVI,       // __oat_cvi_def/use(var, ...): Arg = 'D'/'U' << 16 | var
+  ACT_LOG_PATH,  // __oat_log_path(site, path)
+  ACT_PATH_ADD,  // !oat.path.add: path register += Arg
+  ACT_PATH_SET,  // !oat.path.set: path register = Arg
+  ACT_CALL,      // direct call to a defined function
+  ACT_ICALL,     // indirect call
+  ACT_INIT,      // __oat_init(), __oat_op_begin()
+  ACT_FINAL,     // __oat_print_proof(), __oat_finalize_async()
+};
+
+struct Action {
+  ActionKind Kind;
+  uint32_t Arg; // constant, callee index or call-type index
+};
+
+enum TermKind : uint8_t {
+  TERM_BR,       // Succs[0]
+  TERM_CONDBR,   // logged: Succs[0] true, Succs[1] false
+  TERM_LOOPBR,   // compressed (!oat.loop): Succs[ExitIdx] leaves the loop
+  TERM_MULTI,    // switch / indirectbr: any successor
+  TERM_PATH,     // numbered (!oat.path): the successor S_path leads to
+  TERM_RET,
+  TERM_STOP,     // unreachable, resume, ...
+};
+
+struct Block {
+  std::vector<Action> Actions;
+  TermKind Term = TERM_STOP;
+  std::vector<uint32_t> Succs;
+  uint32_t LoopSite = 0;
+  uint32_t ExitIdx = 0;
+  uint32_t PathSite = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> PathEdges; // (value, paths) per successor
+  std::vector<uint8_t> LeadBits; // __oat_log constants before any other hook
+  const BasicBlock *BB = nullptr;
+};
+
+struct Frame {
+  uint32_t Block;
+  uint32_t PC;       // next action
+  uint32_t Path = 0; // path register of a numbered function
+};
+
+struct Func {
+  const Function *F;
+  uint32_t Entry;
+};
+
+struct Program {
+  std::vector<Block> Blocks;
+  std::vector<Func> Funcs;
+  DenseMap<const Function *, uint32_t> FuncIndex;
+  std::vector<const CallBase *> ICalls;        // ACT_ICALL Arg -> call
+  std::vector<std::vector<uint32_t>> ICallCands; // ... -> address-taken callees
+  std::map<uint32_t, std::vector<int32_t>> ICallTables; // site -> callee, -1 external
+  std::vector<std::pair<const Function *, Frame>> InitSites; // resume after the call
+};
+
+static uint32_t mdConst(const MDNode *MD, unsigned I) {
+  return (uint32_t)mdconst::extract<ConstantInt>(MD->getOperand(I))->getZExtValue();
+}
+
+static bool constArg(const CallBase *CB, unsigned I, uint32_t &V) {
+  auto *C = dyn_cast<ConstantInt>(CB->getArgOperand(I));
+  if (!C) return false;
+  V = (uint32_t)C->getZExtValue();
+  return true;
+}
+
+// Same as the pass: pointer types are interchangeable, since with typed
+// pointers one object is often passed as i8* on one side and as a
+// struct* on the other
+static bool compatibleType(Type *A, Type *B) {
+  return A == B || (A->isPointerTy() && B->isPointerTy());
+}
+
+// Could this call reach F? As in the pass, the call's own type is not
+// compared, only its return type and the arguments actually passed, so
+// unprototyped C calls through a varargs type still find their targets.
+static bool isCompatibleTarget(const CallBase &CB, const Function &F) {
+  FunctionType *FT = F.getFunctionType();
+  if (!compatibleType(CB.getType(), FT->getReturnType())) return false;
+  if (FT->isVarArg() ? CB.arg_size() < FT->getNumParams()
+                     : CB.arg_size() != FT->getNumParams())
+    return false;
+  for (unsigned I = 0; I < FT->getNumParams(); I++)
+    if (!compatibleType(CB.getArgOperand(I)->getType(), FT->getParamType(I)))
+      return false;
+  return true;
+}
+
+// The pass's __oat_icall_table.<site>: the callee for each index
+static bool decodeICallTable(Module &M, uint32_t Site, Program &P) {
+  if (P.ICallTables.count(Site)) return true;
+  GlobalVariable *GV = M.getNamedGlobal("__oat_icall_table." + std::to_string(Site));
+  if (!GV || !GV->hasInitializer()) return false;
+  auto *Arr = dyn_cast<ConstantArray>(GV->getInitializer());
+  if (!Arr) return false;
+
+  std::vector<int32_t> &Table = P.ICallTables[Site];
+  for (const Use &U : Arr->operands()) {
+    auto *F = dyn_cast<Function>(U->stripPointerCasts());
+    if (!F) return false;
+    Table.push_back(F->isDeclaration() ? -1 : (int32_t)P.FuncIndex.lookup(F));
+  }
+  return true;
+}
+
+static bool decodeModule(Module &M, Program &P, std::string &Err) {
+  DenseMap<const BasicBlock *, uint32_t> BlockIndex;
+  for (Function &F : M) {
+    if (F.isDeclaration()) continue;
+    P.FuncIndex[&F] = P.Funcs.size();
+    P.Funcs.push_back({&F, (uint32_t)P.Blocks.size()});
+    for (BasicBlock &BB : F) {
+      BlockIndex[&BB] = P.Blocks.size();
+      P.Blocks.emplace_back();
+      P.Blocks.back().BB = &BB;
+    }
+  }
+
+  auto fail = [&](const Instruction &I, const char *Why) {
+    Err = std::string(Why) + " in " + I.getFunction()->getName().str();
+    return false;
+  };
+
+  for (uint32_t Idx = 0; Idx < P.Blocks.size(); Idx++) {
+    Block &B = P.Blocks[Idx];
+    bool Leading = true;
+    for (const Instruction &I : *B.BB) {
+      // oat-pass<inline-log>: the bit buffer update stands for __oat_log
+      if (MDNode *MD = I.getMetadata("oat.bit")) {
+        uint32_t Bit = mdconst::extract<ConstantInt>(MD->getOperand(0))->getZExtValue();
+        B.Actions.push_back({ACT_LOG, Bit});
+        if (Leading) B.LeadBits.push_back(Bit != 0);
+        continue;
+      }
+
+      // oat-pass<path-log>: updates of the path register
+      if (MDNode *MD = I.getMetadata("oat.path.add")) {
+        B.Actions.push_back({ACT_PATH_ADD, mdConst(MD, 0)});
+        Leading = false;
+        continue;
+      }
+      if (MDNode *MD = I.getMetadata("oat.path.set")) {
+        B.Actions.push_back({ACT_PATH_SET, mdConst(MD, 0)});
+        Leading = false;
+        continue;
+      }
+
+      auto *CB = dyn_cast<CallBase>(&I);
+      if (!CB || isa<IntrinsicInst>(CB)) continue;
+
+      const Function *Callee = CB->getCalledFunction();
+      Action A{ACT_CALL, 0};
+
+      if (CB->isIndirectCall()) {
+        A = {ACT_ICALL, (uint32_t)P.ICalls.size()};
+        P.ICalls.push_back(CB);
+      } else if (!Callee) {
+        continue;
+      } else if (Callee->getName() == "__oat_log") {
+        if (!constArg(CB, 0, A.Arg)) return fail(I, "non-constant __oat_log");
+        A.Kind = ACT_LOG;
+        if (Leading) B.LeadBits.push_back(A.Arg != 0);
+      } else if (Callee->getName() == "__oat_func_enter") {
+        if (!constArg(CB, 0, A.Arg)) return fail(I, "non-constant __oat_func_enter");
+        A.Kind = ACT_ENTER;
+      } else if (Callee->getName() == "__oat_func_exit" ||
+                 Callee->getName() == "__oat_func_exit_sync") {
+        if (!constArg(CB, 0, A.Arg)) return fail(I, "non-constant __oat_func_exit");
+        A.Kind = ACT_EXIT;
+      } else if (Callee->getName() == "__oat_log_loop") {
+        if (!constArg(CB, 0, A.Arg)) return fail(I, "non-constant __oat_log_loop site");
+        A.Kind = ACT_LOG_LOOP;
+      } else if (Callee->getName() == "__oat_log_path") {
+        if (!constArg(CB, 0, A.Arg)) return fail(I, "non-constant __oat_log_path site");
+        A.Kind = ACT_LOG_PATH;
+      } else if (Callee->getName() == "__oat_log_indirect") {
+        A.Kind = ACT_LOG_ICALL;
+      } else if (Callee->getName() == "__oat_log_indirect_idx") {
+        if (!constArg(CB, 0, A.Arg)) return fail(I, "non-constant __oat_log_indirect_idx site");
+        if (!decodeICallTable(M, A.Arg, P)) return fail(I, "missing or malformed .oat_icall table");
+        A.Kind = ACT_LOG_IDX;
+      } else if (Callee->getName() == "__oat_cvi_def" ||
+                 Callee->getName() == "__oat_cvi_use") {
+        if (!constArg(CB, 0, A.Arg)) return fail(I, "non-constant CVI variable");
+        A.Kind = ACT_CVI;
+        A.Arg = (Callee->getName() == "__oat_cvi_def" ? 'D' : 'U') << 16 | (A.Arg & 0xFFFF);
+      } else if (Callee->getName() == "__oat_init" ||
+                 Callee->getName() == "__oat_op_begin") {
+        A.Kind = ACT_INIT;
+        P.InitSites.push_back({I.getFunction(), {Idx, (uint32_t)B.Actions.size() + 1}});
+      } else if (Callee->getName() == "__oat_print_proof" ||
+                 Callee->getName() == "__oat_finalize_async") {
+        A.Kind = ACT_FINAL;
+      } else if (!Callee->isDeclaration()) {
+        A.Arg = P.FuncIndex[Callee];
+      } else {
+        continue; // libc, other __oat_* runtime calls: no events
+      }
+
+      if (A.Kind != ACT_LOG) Leading = false;
+      B.Actions.push_back(A);
+    }
+
+    const Instruction *T = B.BB->getTerminator();
+    for (const BasicBlock *S : successors(B.BB)) B.Succs.push_back(BlockIndex[S]);
+
+    if (MDNode *MD = T->getMetadata("oat.path")) {
+      // Split edges leave the successors in place, so operands still pair up
+      if (MD->getNumOperands() != 1 + 2 * B.Succs.size())
+        return fail(*T, "malformed !oat.path");
+      B.Term = TERM_PATH;
+      B.PathSite = mdConst(MD, 0);
+      for (unsigned I = 1; I < MD->getNumOperands(); I += 2)
+        B.PathEdges.push_back({mdConst(MD, I), mdConst(MD, I + 1)});
+    } else if (auto *BI = dyn_cast<BranchInst>(T)) {
+      if (BI->isUnconditional()) {
+        B.Term = TERM_BR;
+      } else if (BI->getMetadata("oat.flush")) {
+        // Bit buffer full: the flush block only hands bits to the runtime
+        B.Term = TERM_BR;
+        B.Succs = {B.Succs[1]};
+      } else if (MDNode *MD = BI->getMetadata("oat.loop")) {
+        auto *Site = mdconst::extract<ConstantInt>(MD->getOperand(0));
+        B.Term = TERM_LOOPBR;
+        B.LoopSite = (uint32_t)Site->getZExtValue();
+        // The pass requires a dedicated exit block with the loop hook
+        B.ExitIdx = 1;
+        for (const Action &A : P.Blocks[B.Succs[0]].Actions)
+          if (A.Kind == ACT_LOG_LOOP && A.Arg == B.LoopSite) B.ExitIdx = 0;
+      } else {
+        B.Term = TERM_CONDBR;
+      }
+    } else if (isa<ReturnInst>(T)) {
+      B.Term = TERM_RET;
+    } else if (isa<SwitchInst>(T) || isa<IndirectBrInst>(T)) {
+      B.Term = TERM_MULTI;
+    } else {
+      B.Term = TERM_STOP;
+    }
+  }
+
+  // Without a symbol map an indirect target can only be one of the
+  // address-taken functions the call could reach, by the same test the
+  // pass builds its target tables with
+  P.ICallCands.resize(P.ICalls.size());
+  for (size_t C = 0; C < P.ICalls.size(); C++)
+    for (const Func &F : P.Funcs)
+      if (F.F->hasAddressTaken() && isCompatibleTarget(*P.ICalls[C], *F.F))
+        P.ICallCands[C].push_back(P.FuncIndex[F.F]);
+
+  return true;
+}
+
+/* --- Replay --- */
+
+struct LoopCounter {
+  uint32_t Depth;
+  uint32_t Site;
+  uint32_t Runs; // times the exiting block has run in this loop instance
+};
+
+struct State {
+  std::vector<Frame> Frames;
+  std::vector<uint16_t> Shadow;
+  std::vector<LoopCounter> Loops;
+  std::map<uint64_t, uint32_t> Bound; // indirect target -> function
+  uint32_t BitPos = 0, AddrPos = 0, LoopPos = 0, ICallPos = 0, PathPos = 0;
+  uint64_t LastAddr = 0;
+  int32_t IdxTarget = 0;   // callee named by the last S_icall index
+  bool IdxPending = false; // ... and the indirect call has not run yet
+  size_t StreamLen = 0;
+};
+
+// A pending alternative: restore State, then take Alts[Next]
+struct Choice {
+  State Saved;
+  std::vector<uint32_t> Alts;
+  size_t Next;
+  bool IsCall;
+};
+
+struct Failure {
+  std::string Why;
+  uint32_t Block = 0;
+  uint32_t BitPos = 0, AddrPos = 0, LoopPos = 0, ICallPos = 0, PathPos = 0;
+  size_t Progress = 0;
+};
+
+class Replayer {
+public:
+  Replayer(const Program &P, const Trace &T,
+           const std::map<uint64_t, std::string> &Syms, uint32_t Alg)
+      : P(P), T(T), Syms(Syms), Alg(Alg) {
+    for (const LoopRecord &R : T.Loops)
+      if (R.Trips > MaxTrips[R.Site]) MaxTrips[R.Site] = R.Trips;
+  }
+
+  // Replays from Start until a proof is produced whose digest equals
+  // Expected (or, with no expected proof, until the first complete path)
+  bool run(const Frame &Start, const uint8_t *Expected, uint8_t Digest[OAT_HASH_SIZE]);
+
+  Failure Best;
+  uint64_t Steps = 0, Backtracks = 0;
+  uint64_t Complete = 0; // paths that consumed the whole trace
+
+private:
+  const Program &P;
+  const Trace &T;
+  const std::map<uint64_t, std::string> &Syms;
+  uint32_t Alg;
+  std::map<uint32_t, uint32_t> MaxTrips;
+
+  State S;
+  std::string Stream;
+  std::vector<Choice> Choices;
+
+  void emit(const void *D, size_t N) {
+    Stream.append((const char *)D, N);
+    S.StreamLen = Stream.size();
+  }
+  void emit16(uint16_t V) {
+    uint8_t B[2] = {(uint8_t)V, (uint8_t)(V >> 8)};
+    emit(B, 2);
+  }
+
+  bool fail(const std::string &Why);
+  bool leadMatches(uint32_t Block) const;
+  bool pathSuccessor(const Block &B, uint32_t Path, uint32_t &Succ) const;
+  void branch(std::vector<uint32_t> Alts, bool IsCall);
+  void take(uint32_t Alt, bool IsCall);
+  bool resolveICall(uint32_t CallIdx, std::vector<uint32_t> &Alts, bool &External);
+  void finish(uint8_t Digest[OAT_HASH_SIZE]);
+};
+
+// Records the deepest divergence, then rewinds to the latest open choice.
+// Returns false when there is nothing left to try.
+bool Replayer::fail(const std::string &Why) {
+  size_t Progress =
+      (size_t)S.BitPos + S.AddrPos + S.LoopPos + S.ICallPos + S.PathPos + S.StreamLen;
+  if (Best.Why.empty() || Progress >= Best.Progress) {
+    Best.Why = Why;
+    Best.Block = S.Frames.empty() ? 0 : S.Frames.back().Block;
+    Best.BitPos = S.BitPos;
+    Best.AddrPos = S.AddrPos;
+    Best.LoopPos = S.LoopPos;
+    Best.ICallPos = S.ICallPos;
+    Best.PathPos = S.PathPos;
+    Best.Progress = Progress;
+  }
+
+  while (!Choices.empty()) {
+    Choice &C = Choices.back();
+    if (C.Next == C.Alts.size()) {
+      Choices.pop_back();
+      continue;
+    }
+    if (++Backtracks > MAX_BACKTRACKS) {
+      Best.Why = "search budget exhausted (last: " + Best.Why + ")";
+      return false;
+    }
+    S = C.Saved;
+    Stream.resize(S.StreamLen);
+    uint32_t Alt = C.Alts[C.Next++];
+    bool IsCall = C.IsCall;
+    if (C.Next == C.Alts.size()) Choices.pop_back();
+    take(Alt, IsCall);
+    return true;
+  }
+  return false;
+}
+
+// A successor is only worth trying if its leading branch hooks agree
+// with the next bits of S_bin
+bool Replayer::leadMatches(uint32_t Block) const {
+  const std::vector<uint8_t> &Lead = P.Blocks[Block].LeadBits;
+  if (S.BitPos + Lead.size() > T.Bits) return false;
+  for (size_t I = 0; I < Lead.size(); I++)
+    if (T.bit(S.BitPos + I) != Lead[I]) return false;
+  return true;
+}
+
+// Paths end before any call that could log one, so the path being walked
+// is the next S_path record: exactly one edge's range of path IDs holds it
+bool Replayer::pathSuccessor(const Block &B, uint32_t Path, uint32_t &Succ) const {
+  if (S.PathPos >= T.Paths.size() || T.Paths[S.PathPos].Site != B.PathSite) return false;
+  // Values are relative to the register and wrap: with oat-pass<pgo> it
+  // may trail the path ID by any constant. A wrong pick would still end
+  // in a path that differs from S_path.
+  uint32_t Target = T.Paths[S.PathPos].Path;
+  for (size_t I = 0; I < B.Succs.size(); I++) {
+    uint32_t Val = B.PathEdges[I].first, Span = B.PathEdges[I].second;
+    if (Target - Path - Val < Span) {
+      Succ = B.Succs[I];
+      return true;
+    }
+  }
+  return false;
+}
+
+void Replayer::take(uint32_t Alt, bool IsCall) {
+  if (IsCall) {
+    S.Frames.push_back({P.Funcs[Alt].Entry, 0});
+  } else {
+    S.Frames.back().Block = Alt;
+    S.Frames.back().PC = 0;
+  }
+}
+
+void Replayer::branch(std::vector<uint32_t> Alts, bool IsCall) {
+  if (Alts.size() > 1) Choices.push_back({S, Alts, 1, IsCall});
+  take(Alts[0], IsCall);
+}
+
+// Candidates for the target just logged by __oat_log_indirect. An address
+// keeps the function it was first bound to for the rest of the operation.
+bool Replayer::resolveICall(uint32_t CallIdx, std::vector<uint32_t> &Alts, bool &External) {
+  External = false;
+  auto B = S.Bound.find(S.LastAddr);
+  if (B != S.Bound.end()) {
+    Alts = {B->second};
+    return true;
+  }
+
+  if (!Syms.empty()) {
+    auto It = Syms.find(S.LastAddr);
+    if (It == Syms.end()) return false;
+    for (const Func &F : P.Funcs)
+      if (F.F->getName() == It->second) {
+        Alts = {P.FuncIndex.lookup(F.F)};
+        return true;
+      }
+    External = true; // a library function: no events
+    return true;
+  }
+
+  for (uint32_t F : P.ICallCands[CallIdx]) {
+    bool Taken = false;
+    for (auto &KV : S.Bound) Taken |= (KV.second == F);
+    if (!Taken) Alts.push_back(F);
+  }
+  if (Alts.empty()) External = true;
+  return true;
+}
+
+void Replayer::finish(uint8_t Digest[OAT_HASH_SIZE]) {
+  uint8_t AlgLE[4] = {(uint8_t)Alg, (uint8_t)(Alg >> 8), (uint8_t)(Alg >> 16),
+                      (uint8_t)(Alg >> 24)};
+  if (Alg == OAT_HASH_BLAKE2S) {
+    blake2s_state B;
+    blake2s_init(&B, BLAKE2S_OUTBYTES);
+    blake2s_update(&B, AlgLE, 4);
+    blake2s_update(&B, Stream.data(), Stream.size());
+    blake2s_final(&B, Digest);
+  } else {
+    sha256_ctx C;
+    sha256_init(&C);
+    sha256_update(&C, AlgLE, 4);
+    sha256_update(&C, Stream.data(), Stream.size());
+    sha256_final(&C, Digest);
+  }
+}
+
+bool Replayer::run(const Frame &Start, const uint8_t *Expected,
+                   uint8_t Digest[OAT_HASH_SIZE]) {
+  S = State();
+  S.Frames.push_back(Start);
+  Stream.clear();
+  Choices.clear();
+
+  while (true) {
+    if (++Steps > MAX_STEPS) {
+      Best.Why = "step budget exhausted (uninstrumented cycle?)";
+      return false;
+    }
+
+    Frame &F = S.Frames.back();
+    const Block &B = P.Blocks[F.Block];
+
+    if (F.PC < B.Actions.size()) {
+      const Action &A = B.Actions[F.PC++];
+      switch (A.Kind) {
+      case ACT_LOG: {
+        if (S.BitPos >= T.Bits) {
+          if (!fail("S_bin exhausted")) return false;
+          break;
+        }
+        if (T.bit(S.BitPos) != (A.Arg != 0)) {
+          if (!fail("branch decision differs from S_bin")) return false;
+          break;
+        }
+        S.BitPos++;
+        char C = A.Arg ? '1' : '0';
+        emit(&C, 1);
+        break;
+      }
+      case ACT_ENTER:
+        S.Shadow.push_back((uint16_t)A.Arg);
+        emit16((uint16_t)A.Arg);
+        break;
+      case ACT_EXIT:
+        // Frames entered before the operation started are not on our copy
+        if (!S.Shadow.empty()) {
+          if (S.Shadow.back() != (uint16_t)A.Arg) {
+            if (!fail("shadow stack mismatch")) return false;
+            break;
+          }
+          S.Shadow.pop_back();
+        }
+        emit16((uint16_t)A.Arg);
+        break;
+      case ACT_LOG_LOOP: {
+        if (S.LoopPos >= T.Loops.size() || T.Loops[S.LoopPos].Site != A.Arg) {
+          if (!fail("loop exit not in S_loop")) return false;
+          break;
+        }
+        const LoopRecord &R = T.Loops[S.LoopPos++];
+        uint8_t Rec[9] = {'L'};
+        memcpy(&Rec[1], &R.Site, 4);
+        memcpy(&Rec[5], &R.Trips, 4);
+        emit(Rec, sizeof(Rec));
+        uint32_t Depth = S.Frames.size();
+        for (size_t I = S.Loops.size(); I-- > 0;)
+          if (S.Loops[I].Depth == Depth && S.Loops[I].Site == A.Arg) {
+            S.Loops.erase(S.Loops.begin() + I);
+            break;
+          }
+        break;
+      }
+      case ACT_LOG_ICALL: {
+        if (S.AddrPos >= T.Addrs.size()) {
+          if (!fail("S_addr exhausted")) return false;
+          break;
+        }
+        S.LastAddr = T.Addrs[S.AddrPos++];
+        uint8_t LE[8];
+        for (int I = 0; I < 8; I++) LE[I] = (uint8_t)(S.LastAddr >> (8 * I));
+        emit(LE, 8);
+        break;
+      }
+      case ACT_LOG_IDX: {
+        if (S.ICallPos >= T.ICalls.size()) {
+          if (!fail("S_icall exhausted")) return false;
+          break;
+        }
+        uint8_t Idx = T.ICalls[S.ICallPos++];
+        const std::vector<int32_t> &Table = P.ICallTables.at(A.Arg);
+        if (Idx >= Table.size()) {
+          if (!fail("S_icall index outside its site's table")) return false;
+          break;
+        }
+        emit(&Idx, 1);
+        S.IdxTarget = Table[Idx];
+        S.IdxPending = true;
+        break;
+      }
+      case ACT_LOG_PATH: {
+        if (S.PathPos >= T.Paths.size() || T.Paths[S.PathPos].Site != A.Arg) {
+          if (!fail("path end not in S_path")) return false;
+          break;
+        }
+        if (T.Paths[S.PathPos].Path != F.Path) {
+          if (!fail("path differs from S_path")) return false;
+          break;
+        }
+        const PathRecord &R = T.Paths[S.PathPos++];
+        uint8_t Rec[9] = {'P'};
+        memcpy(&Rec[1], &R.Site, 4);
+        memcpy(&Rec[5], &R.Path, 4);
+        emit(Rec, sizeof(Rec));
+        break;
+      }
+      case ACT_PATH_ADD:
+        F.Path += A.Arg;
+        break;
+      case ACT_PATH_SET:
+        F.Path = A.Arg;
+        break;
+      case ACT_CVI: {
+        // Values are checked by the TA; the hash only has kind and variable
+        uint8_t Rec[3] = {(uint8_t)(A.Arg >> 16), (uint8_t)A.Arg, (uint8_t)(A.Arg >> 8)};
+        emit(Rec, sizeof(Rec));
+        break;
+      }
+      case ACT_CALL:
+        if (S.Frames.size() >= MAX_DEPTH) {
+          if (!fail("call depth limit")) return false;
+          break;
+        }
+        S.Frames.push_back({P.Funcs[A.Arg].Entry, 0});
+        break;
+      case ACT_ICALL: {
+        // A table index names the callee outright
+        if (S.IdxPending) {
+          S.IdxPending = false;
+          if (S.IdxTarget >= 0) take((uint32_t)S.IdxTarget, true);
+          break;
+        }
+        std::vector<uint32_t> Alts;
+        bool External;
+        if (!resolveICall(A.Arg, Alts, External)) {
+          if (!fail("indirect target not in symbol map")) return false;
+          break;
+        }
+        if (External) break;
+        uint64_t Addr = S.LastAddr;
+        if (Alts.size() == 1) {
+          S.Bound[Addr] = Alts[0];
+          take(Alts[0], true);
+          break;
+        }
+        // Each alternative binds the address before it is taken; pushed
+        // in reverse so they are retried in candidate order
+        for (size_t I = Alts.size(); I-- > 1;) {
+          Choices.push_back({S, {Alts[I]}, 0, true});
+          Choices.back().Saved.Bound[Addr] = Alts[I];
+        }
+        S.Bound[Addr] = Alts[0];
+        take(Alts[0], true);
+        break;
+      }
+      case ACT_INIT:
+        if (!fail("operation restarted before its proof")) return false;
+        break;
+      case ACT_FINAL: {
+        if (S.BitPos != T.Bits || S.AddrPos != T.Addrs.size() ||
+            S.LoopPos != T.Loops.size() || S.ICallPos != T.ICalls.size() ||
+            S.PathPos != T.Paths.size()) {
+          if (!fail("proof reached with unconsumed trace")) return false;
+          break;
+        }
+        finish(Digest);
+        Complete++;
+        if (!Expected || memcmp(Digest, Expected, OAT_HASH_SIZE) == 0) return true;
+        if (!fail(PROOF_DIFFERS)) return false;
+        break;
+      }
+      }
+      continue;
+    }
+
+    switch (B.Term) {
+    case TERM_BR:
+      F.Block = B.Succs[0];
+      F.PC = 0;
+      break;
+    case TERM_PATH: {
+      uint32_t Succ;
+      if (!pathSuccessor(B, F.Path, Succ)) {
+        if (!fail("no successor leads to the next S_path record")) return false;
+        break;
+      }
+      F.Block = Succ;
+      F.PC = 0;
+      break;
+    }
+    case TERM_CONDBR:
+    case TERM_MULTI: {
+      std::vector<uint32_t> Alts;
+      for (uint32_t Succ : B.Succs) {
+        bool Dup = false;
+        for (uint32_t A : Alts) Dup |= (A == Succ);
+        if (!Dup && leadMatches(Succ)) Alts.push_back(Succ);
+      }
+      if (Alts.empty()) {
+        if (!fail(B.Term == TERM_CONDBR ? "no successor matches S_bin"
+                                        : "no switch successor matches S_bin"))
+          return false;
+        break;
+      }
+      branch(Alts, false);
+      break;
+    }
+    case TERM_LOOPBR: {
+      uint32_t Depth = S.Frames.size();
+      LoopCounter *LC = nullptr;
+      for (LoopCounter &C : S.Loops)
+        if (C.Depth == Depth && C.Site == B.LoopSite) LC = &C;
+      if (!LC) {
+        S.Loops.push_back({Depth, B.LoopSite, 0});
+        LC = &S.Loops.back();
+      }
+      uint32_t Trips = LC->Runs++;
+
+      // Leave when the next S_loop record is this exit; staying is only
+      // possible while some record of this site has more trips
+      bool CanExit = S.LoopPos < T.Loops.size() &&
+                     T.Loops[S.LoopPos].Site == B.LoopSite &&
+                     T.Loops[S.LoopPos].Trips == Trips;
+      auto MT = MaxTrips.find(B.LoopSite);
+      bool CanStay = MT != MaxTrips.end() && Trips < MT->second;
+
+      std::vector<uint32_t> Alts;
+      if (CanExit) Alts.push_back(B.Succs[B.ExitIdx]);
+      if (CanStay) Alts.push_back(B.Succs[1 - B.ExitIdx]);
+      if (Alts.empty()) {
+        if (!fail("compressed loop trip count not in S_loop")) return false;
+        break;
+      }
+      branch(Alts, false);
+      break;
+    }
+    case TERM_RET: {
+      uint32_t Depth = S.Frames.size();
+      if (Depth == 1) {
+        if (!fail("returned from the start function before the proof")) return false;
+        break;
+      }
+      while (!S.Loops.empty() && S.Loops.back().Depth >= Depth) S.Loops.pop_back();
+      S.Frames.pop_back();
+      break;
+    }
+    case TERM_STOP:
+      if (!fail("reached a block with no successors")) return false;
+      break;
+    }
+  }
+}
+
+/* --- Driver --- */
+
+static bool readFile(const char *Path, std::vector<uint8_t> &Out) {
+  std::ifstream In(Path, std::ios::binary);
+  if (!In) return false;
+  Out.assign(std::istreambuf_iterator<char>(In), std::istreambuf_iterator<char>());
+  return true;
+}
+
+// nm-style map: "<hex addr> <type> <name>" or "<hex addr> <name>"
+static bool readSymbols(const char *Path, std::map<uint64_t, std::string> &Syms) {
+  std::ifstream In(Path);
+  if (!In) return false;
+  std::string Line;
+  while (std::getline(In, Line)) {
+    char Name[512], Type[8];
+    unsigned long long Addr;
+    if (sscanf(Line.c_str(), "%llx %7s %511s", &Addr, Type, Name) == 3)
+      Syms[Addr] = Name;
+    else if (sscanf(Line.c_str(), "%llx %511s", &Addr, Name) == 2)
+      Syms[Addr] = Name;
+  }
+  return true;
+}
+
+static bool parseHex(const char *Hex, uint8_t Out[OAT_HASH_SIZE]) {
+  if (strlen(Hex) != 2 * OAT_HASH_SIZE) return false;
+  for (uint32_t I = 0; I < OAT_HASH_SIZE; I++) {
+    unsigned V;
+    if (sscanf(Hex + 2 * I, "%2x", &V) != 1) return false;
+    Out[I] = (uint8_t)V;
+  }
+  return true;
+}
+
+static void usage() {
+  errs() << "usage: oat_verify [-p <proof hex>] [-a sha256|blake2s] [-s <func>]\n"
+            "                  [-m <symbols>] <instrumented.ll|.bc> <blob>\n"
+            "       oat_verify -b <manifest|dir|-> [-j <threads>] [-o <results.csv>]\n"
+            "                  [-a ...] [-s ...] [-m ...] <instrumented.ll|.bc>\n"
+            "  -p  proof printed by __oat_print_proof (omit to just compute it)\n"
+            "  -a  hash backend of the session (OAT_HASH), default sha256\n"
+            "  -s  function whose __oat_init/__oat_op_begin starts the operation\n"
+            "  -m  address map for indirect targets (nm -n output of the binary)\n"
+            "  -b  batch: manifest lines \"<blob> <proof|-> [alg]\", a directory of\n"
+            "      *.bin with <name>.proof next to each, or - for a manifest on stdin\n"
+            "  -j  worker threads (default: all cores)\n"
+            "  -o  per-blob CSV results, streamed as they finish (default stdout)\n";
+}
+
+/* --- One verification --- */
+
+struct Job {
+  std::string Blob;
+  bool HasProof = false;
+  uint8_t Proof[OAT_HASH_SIZE];
+  uint32_t Alg = OAT_HASH_SHA256;
+  std::string Err; // set when the manifest entry itself is unusable
+};
+
+// V_COMPUTED: no proof was given, so the digest of the first consistent
+// path is reported but nothing was attested
+enum Verdict { V_ACCEPT, V_REJECT, V_ERROR, V_COMPUTED };
+
+struct Outcome {
+  Verdict V = V_ERROR;
+  std::string Detail;
+  uint8_t Digest[OAT_HASH_SIZE];
+  uint32_t Bits = 0, Addrs = 0, Loops = 0, ICalls = 0, Paths = 0;
+  uint64_t Steps = 0, Backtracks = 0;
+  double Ms = 0;
+};
+
+// Serializes printAsOperand (slot tracking is not thread-safe) and output
+static std::mutex OutLock;
+
+static std::string describeBlock(const Program &P, uint32_t Idx) {
+  std::string Str;
+  raw_string_ostream OS(Str);
+  const BasicBlock *BB = P.Blocks[Idx].BB;
+  OS << BB->getParent()->getName() << ":";
+  BB->printAsOperand(OS, false);
+  return OS.str();
+}
+
+// Program, symbols and start point are shared read-only between workers
+static Outcome verifyJob(const Program &P, const std::map<uint64_t, std::string> &Syms,
+                         const Frame &Start, const Job &J) {
+  Outcome O;
+  auto T0 = std::chrono::steady_clock::now();
+
+  std::vector<uint8_t> Raw;
+  Trace T;
+  std::string Err;
+  if (!J.Err.empty()) {
+    O.Detail = J.Err;
+    return O;
+  }
+  if (!readFile(J.Blob.c_str(), Raw)) {
+    O.Detail = "cannot read blob";
+    return O;
+  }
+  if (!parseBlob(Raw, T, Err)) {
+    O.Detail = Err;
+    return O;
+  }
+  O.Bits = T.Bits;
+  O.Addrs = T.Addrs.size();
+  O.Loops = T.Loops.size();
+  O.ICalls = T.ICalls.size();
+  O.Paths = T.Paths.size();
+
+  Replayer R(P, T, Syms, J.Alg);
+  bool OK = R.run(Start, J.HasProof ? J.Proof : nullptr, O.Digest);
+  O.Steps = R.Steps;
+  O.Backtracks = R.Backtracks;
+
+  if (OK) {
+    O.V = J.HasProof ? V_ACCEPT : V_COMPUTED;
+  } else if (R.Complete > 0) {
+    // The trace itself is a valid path (possibly several), but the hashed
+    // stream (IDs, returns) is not the one that was measured
+    O.V = V_REJECT;
+    O.Detail = "trace fits " + std::to_string(R.Complete) +
+               " program path(s), none reproduces the proof";
+  } else {
+    O.V = V_REJECT;
+    std::lock_guard<std::mutex> G(OutLock);
+    O.Detail = R.Best.Why + " at " + describeBlock(P, R.Best.Block) +
+               ", S_bin bit " + std::to_string(R.Best.BitPos) +
+               ", S_addr " + std::to_string(R.Best.AddrPos) +
+               ", S_loop " + std::to_string(R.Best.LoopPos) +
+               ", S_icall " + std::to_string(R.Best.ICallPos) +
+               ", S_path " + std::to_string(R.Best.PathPos);
+  }
+
+  O.Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - T0).count();
+  return O;
+}
+
+/* --- Batch mode --- */
+
+// Work-stealing pool: jobs are dealt round-robin onto per-worker deques;
+// a worker takes from the back of its own and steals from the front of
+// the others, so one slow blob never holds up a whole share of the batch.
+class BatchPool {
+public:
+  explicit BatchPool(unsigned N) : Queues(N) {}
+
+  void push(Job J) {
+    // Counted before it is visible, so a fast taker never sees Pending == 0
+    {
+      std::lock_guard<std::mutex> G(IdleLock);
+      Pending++;
+    }
+    {
+      WorkQueue &Q = Queues[NextQueue++ % Queues.size()];
+      std::lock_guard<std::mutex> G(Q.M);
+      Q.Jobs.push_back(std::move(J));
+    }
+    Idle.notify_one();
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> G(IdleLock);
+    Closed = true;
+    Idle.notify_all();
+  }
+
+  // Blocks until a job is available; false once closed and drained
+  bool take(unsigned Self, Job &Out) {
+    while (true) {
+      for (size_t K = 0; K < Queues.size(); K++) {
+        WorkQueue &Q = Queues[(Self + K) % Queues.size()];
+        std::lock_guard<std::mutex> G(Q.M);
+        if (Q.Jobs.empty()) continue;
+        if (K == 0) {
+          Out = std::move(Q.Jobs.back());
+          Q.Jobs.pop_back();
+        } else {
+          Out = std::move(Q.Jobs.front());
+          Q.Jobs.pop_front();
+        }
+        std::lock_guard<std::mutex> GI(IdleLock);
+        Pending--;
+        return true;
+      }
+      std::unique_lock<std::mutex> G(IdleLock);
+      Idle.wait(G, [this] { return Pending > 0 || Closed; });
+      if (Pending == 0 && Closed) return false;
+    }
+  }
+
+private:
+  struct WorkQueue {
+    std::mutex M;
+    std::deque<Job> Jobs;
+  };
+  std::vector<WorkQueue> Queues;
+  size_t NextQueue = 0;
+  std::mutex IdleLock;
+  std::condition_variable Idle;
+  size_t Pending = 0;
+  bool Closed = false;
+};
+
+// "<proof hex|-> [sha256|blake2s]" (manifest tail or .proof file)
+static void parseProofSpec(const std::string &Spec, uint32_t DefaultAlg, Job &J) {
+  char Hex[128] = "", AlgName[16] = "";
+  J.Alg = DefaultAlg;
+  int N = sscanf(Spec.c_str(), "%127s %15s", Hex, AlgName);
+  if (N >= 2) {
+    if (!strcmp(AlgName, "sha256")) J.Alg = OAT_HASH_SHA256;
+    else if (!strcmp(AlgName, "blake2s")) J.Alg = OAT_HASH_BLAKE2S;
+    else J.Err = std::string("unknown hash backend ") + AlgName;
+  }
+  if (N < 1) J.Err = "no proof";
+  else if (strcmp(Hex, "-") != 0) {
+    J.HasProof = parseHex(Hex, J.Proof);
+    if (!J.HasProof) J.Err = "malformed proof";
+  }
+}
+
+static std::string csvField(const std::string &S) {
+  if (S.find_first_of(",\"") == std::string::npos) return S;
+  std::string Q = "\"";
+  for (char C : S) Q += (C == '"') ? std::string("\"\"") : std::string(1, C);
+  return Q + "\"";
+}
+
+static int runBatch(const Program &P, const std::map<uint64_t, std::string> &Syms,
+                    const Frame &Start, const char *Source, uint32_t DefaultAlg,
+                    unsigned Threads, const char *OutPath) {
+  FILE *Out = OutPath ? fopen(OutPath, "w") : stdout;
+  if (!Out) {
+    errs() << "oat_verify: cannot write " << OutPath << "\n";
+    return 2;
+  }
+  fprintf(Out, "blob,result,detail,bits,addrs,loops,icalls,paths,steps,backtracks,verify_ms,proof\n");
+  fflush(Out);
+
+  BatchPool Pool(Threads);
+  uint64_t Count[4] = {0, 0, 0, 0};
+  double BusyMs = 0;
+
+  auto T0 = std::chrono::steady_clock::now();
+  std::vector<std::thread> Workers;
+  for (unsigned W = 0; W < Threads; W++) {
+    Workers.emplace_back([&, W] {
+      Job J;
+      while (Pool.take(W, J)) {
+        Outcome O = verifyJob(P, Syms, Start, J);
+        static const char *Names[] = {"accept", "reject", "error", "computed"};
+        // The digest of the replayed path; none when no path reproduced it
+        char Proof[2 * OAT_HASH_SIZE + 1] = "";
+        if (O.V == V_ACCEPT || O.V == V_COMPUTED)
+          for (unsigned I = 0; I < OAT_HASH_SIZE; I++) snprintf(Proof + 2 * I, 3, "%02x", O.Digest[I]);
+        std::lock_guard<std::mutex> G(OutLock);
+        Count[O.V]++;
+        BusyMs += O.Ms;
+        fprintf(Out, "%s,%s,%s,%u,%u,%u,%u,%u,%llu,%llu,%.3f,%s\n", csvField(J.Blob).c_str(),
+                Names[O.V], csvField(O.Detail).c_str(), O.Bits, O.Addrs, O.Loops, O.ICalls,
+                O.Paths,
+                (unsigned long long)O.Steps, (unsigned long long)O.Backtracks, O.Ms, Proof);
+        fflush(Out);
+      }
+    });
+  }
+
+  // Feed jobs as they are read, so a manifest on stdin streams
+  struct stat St;
+  if (strcmp(Source, "-") != 0 && stat(Source, &St) == 0 && S_ISDIR(St.st_mode)) {
+    DIR *D = opendir(Source);
+    std::vector<std::string> Names;
+    while (struct dirent *E = D ? readdir(D) : nullptr) {
+      std::string N = E->d_name;
+      if (N.size() > 4 && N.compare(N.size() - 4, 4, ".bin") == 0) Names.push_back(N);
+    }
+    if (D) closedir(D);
+    std::sort(Names.begin(), Names.end());
+    for (const std::string &N : Names) {
+      Job J;
+      J.Blob = std::string(Source) + "/" + N;
+      std::ifstream PF(std::string(Source) + "/" + N.substr(0, N.size() - 4) + ".proof");
+      std::string Spec;
+      if (PF && std::getline(PF, Spec)) parseProofSpec(Spec, DefaultAlg, J);
+      else J.Err = "no .proof file";
+      Pool.push(std::move(J));
+    }
+  } else {
+    std::ifstream File;
+    bool FromStdin = strcmp(Source, "-") == 0;
+    if (!FromStdin) File.open(Source);
+    std::istream &In = FromStdin ? std::cin : File;
+    if (!FromStdin && !File) errs() << "oat_verify: cannot read " << Source << "\n";
+
+    // Relative blob paths are relative to the manifest
+    std::string Base;
+    if (!FromStdin) {
+      std::string S = Source;
+      size_t Slash = S.rfind('/');
+      if (Slash != std::string::npos) Base = S.substr(0, Slash + 1);
+    }
+
+    std::string Line;
+    while (std::getline(In, Line)) {
+      size_t B = Line.find_first_not_of(" \t");
+      if (B == std::string::npos || Line[B] == '#') continue;
+      size_t E = Line.find_first_of(" \t", B);
+      Job J;
+      J.Blob = Line.substr(B, E == std::string::npos ? std::string::npos : E - B);
+      if (J.Blob[0] != '/') J.Blob = Base + J.Blob;
+      parseProofSpec(E == std::string::npos ? "" : Line.substr(E), DefaultAlg, J);
+      Pool.push(std::move(J));
+    }
+  }
+  Pool.close();
+  for (std::thread &W : Workers) W.join();
+
+  double WallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - T0).count();
+  if (Out != stdout) fclose(Out);
+
+  uint64_t Total = Count[V_ACCEPT] + Count[V_REJECT] + Count[V_ERROR] + Count[V_COMPUTED];
+  errs() << format("[OAT-VERIFY] %llu blobs: %llu accept, %llu reject, %llu error, "
+                   "%llu computed (no proof given, not attested)\n",
+                   (unsigned long long)Total, (unsigned long long)Count[V_ACCEPT],
+                   (unsigned long long)Count[V_REJECT], (unsigned long long)Count[V_ERROR],
+                   (unsigned long long)Count[V_COMPUTED]);
+  if (Total) {
+    // Per-core rate from busy time is what sizes a server: it does not
+    // depend on how well this batch happened to fill the threads
+    errs() << format("[OAT-VERIFY] %.1f ms wall on %u threads: %.0f blobs/s, "
+                     "%.0f blobs/s per core (%.3f ms/blob busy)\n",
+                     WallMs, Threads, Total * 1000.0 / WallMs,
+                     BusyMs > 0 ? Total * 1000.0 / BusyMs : 0.0, BusyMs / Total);
+  }
+  return Count[V_REJECT] || Count[V_ERROR] ? 1 : 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *ProofHex = nullptr, *StartName = nullptr, *SymPath = nullptr;
+  const char *BatchSrc = nullptr, *OutPath = nullptr;
+  unsigned Threads = std::max(1u, std::thread::hardware_concurrency());
+  uint32_t Alg = OAT_HASH_SHA256;
+  std::vector<const char *> Pos;
+
+  for (int I = 1; I < argc; I++) {
+    std::string A = argv[I];
+    if ((A == "-p" || A == "-a" || A == "-s" || A == "-m" || A == "-b" || A == "-j" ||
+         A == "-o") && I + 1 < argc) {
+      const char *V = argv[++I];
+      if (A == "-p") ProofHex = V;
+      else if (A == "-s") StartName = V;
+      else if (A == "-m") SymPath = V;
+      else if (A == "-b") BatchSrc = V;
+      else if (A == "-o") OutPath = V;
+      else if (A == "-j") Threads = std::max(1, atoi(V));
+      else if (!strcmp(V, "sha256")) Alg = OAT_HASH_SHA256;
+      else if (!strcmp(V, "blake2s")) Alg = OAT_HASH_BLAKE2S;
+      else { usage(); return 2; }
+    } else if (A[0] == '-') {
+      usage();
+      return 2;
+    } else {
+      Pos.push_back(argv[I]);
+    }
+  }
+  if (Pos.size() != (BatchSrc ? 1u : 2u)) {
+    usage();
+    return 2;
+  }
+
+  Job Single;
+  if (!BatchSrc) {
+    Single.Blob = Pos[1];
+    Single.Alg = Alg;
+    Single.HasProof = ProofHex != nullptr;
+    if (ProofHex && !parseHex(ProofHex, Single.Proof)) {
+      errs() << "oat_verify: proof must be " << 2 * OAT_HASH_SIZE << " hex digits\n";
+      return 2;
+    }
+  }
+
+  auto T0 = std::chrono::steady_clock::now();
+
+  LLVMContext Ctx;
+  SMDiagnostic Diag;
+  std::unique_ptr<Module> M = parseIRFile(Pos[0], Diag, Ctx);
+  if (!M) {
+    Diag.print("oat_verify", errs());
+    return 2;
+  }
+
+  Program P;
+  std::string Err;
+  if (!decodeModule(*M, P, Err)) {
+    errs() << "oat_verify: " << Err << "\n";
+    return 2;
+  }
+
+  std::map<uint64_t, std::string> Syms;
+  if (SymPath && !readSymbols(SymPath, Syms)) {
+    errs() << "oat_verify: cannot read " << SymPath << "\n";
+    return 2;
+  }
+
+  // The operation starts right after __oat_init or __oat_op_begin, or at
+  // main when the program relies on the hooks' lazy init
+  Frame Start{0, 0};
+  bool Found = false;
+  for (auto &Site : P.InitSites) {
+    if (StartName ? Site.first->getName() != StartName : P.InitSites.size() != 1)
+      continue;
+    Start = Site.second;
+    Found = true;
+    break;
+  }
+  if (!Found) {
+    const Function *F = M->getFunction(StartName ? StartName : "main");
+    if (!F || F->isDeclaration()) {
+      errs() << "oat_verify: no start point (use -s <function>)\n";
+      return 2;
+    }
+    Start = {P.Funcs[P.FuncIndex[F]].Entry, 0};
+  }
+
+  auto T1 = std::chrono::steady_clock::now();
+  auto ms = [](auto D) { return std::chrono::duration<double, std::milli>(D).count(); };
+
+  if (BatchSrc) {
+    errs() << format("[OAT-VERIFY] module loaded in %.2f ms\n", ms(T1 - T0));
+    return runBatch(P, Syms, Start, BatchSrc, Alg, Threads, OutPath);
+  }
+
+  Outcome O = verifyJob(P, Syms, Start, Single);
+  if (O.V == V_ERROR) {
+    errs() << "oat_verify: " << Single.Blob << ": " << O.Detail << "\n";
+    return 2;
+  }
+
+  outs() << "[OAT-VERIFY] trace: " << O.Bits << " branch bits, " << O.Addrs
+         << " indirect targets, " << O.ICalls << " indexed indirect calls, "
+         << O.Loops << " loop records, " << O.Paths << " path records\n";
+  if (O.V == V_ACCEPT || O.V == V_COMPUTED) {
+    outs() << "[OAT-VERIFY] proof: ";
+    for (uint8_t B : O.Digest) outs() << format("%02x", B);
+    outs() << "\n";
+    if (O.V == V_ACCEPT)
+      outs() << "[OAT-VERIFY] ACCEPT\n";
+    else
+      outs() << "[OAT-VERIFY] first path consistent with the trace (no -p given, not verified)\n";
+  } else {
+    outs() << "[OAT-VERIFY] REJECT: " << O.Detail << "\n";
+  }
+  outs() << format("[OAT-VERIFY] load %.2f ms, replay %.2f ms (%llu steps, %llu backtracks)\n",
+                   ms(T1 - T0), O.Ms, (unsigned long long)O.Steps,
+                   (unsigned long long)O.Backtracks);
+  return O.V == V_REJECT ? 1 : 0;
+}